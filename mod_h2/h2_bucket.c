@@ -133,3 +133,54 @@ int h2_bucket_is_eos(h2_bucket *bucket)
     return bucket->data_size == 0;
 }
 
+
+/* An apr_bucket type that owns a h2_bucket and reads from its
+ * data in place. Copies and splits share the h2_bucket, which is freed
+ * when the last apr_bucket referring to it is destroyed.
+ */
+typedef struct {
+    apr_bucket_refcount refcount;
+    h2_bucket *bucket;
+} h2_bucket_ref;
+
+static apr_status_t h2_bucket_ref_read(apr_bucket *b, const char **str, 
+                                       apr_size_t *len, apr_read_type_e block)
+{
+    h2_bucket_ref *ref = b->data;
+    *str = ref->bucket->data + b->start;
+    *len = b->length;
+    return APR_SUCCESS;
+}
+
+static void h2_bucket_ref_destroy(void *data)
+{
+    h2_bucket_ref *ref = data;
+    if (apr_bucket_shared_destroy(ref)) {
+        h2_bucket_destroy(ref->bucket);
+        apr_bucket_free(ref);
+    }
+}
+
+static const apr_bucket_type_t h2_bucket_type_ref = {
+    "H2_BUCKET", 5, APR_BUCKET_DATA,
+    h2_bucket_ref_destroy,
+    h2_bucket_ref_read,
+    apr_bucket_setaside_noop,
+    apr_bucket_shared_split,
+    apr_bucket_shared_copy
+};
+
+apr_bucket *h2_bucket_to_apr_bucket(h2_bucket *bucket, 
+                                    apr_bucket_alloc_t *list)
+{
+    apr_bucket *b = apr_bucket_alloc(sizeof(*b), list);
+    h2_bucket_ref *ref = apr_bucket_alloc(sizeof(*ref), list);
+    
+    APR_BUCKET_INIT(b);
+    b->free = apr_bucket_free;
+    b->list = list;
+    ref->bucket = bucket;
+    b = apr_bucket_shared_make(b, ref, 0, bucket->data_len);
+    b->type = &h2_bucket_type_ref;
+    return b;
+}
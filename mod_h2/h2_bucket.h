@@ -109,4 +109,12 @@ apr_size_t h2_bucket_consume(h2_bucket *bucket, apr_size_t len);
 
 int h2_bucket_is_eos(h2_bucket *bucket);
 
+/* Create an apr_bucket that takes ownership of the h2_bucket and
+ * reads its data in place, without copying. Setting it aside is a no-op
+ * since the data does not live in any pool. The h2_bucket is destroyed
+ * together with the last apr_bucket referring to it.
+ * Use this only from one thread. */
+apr_bucket *h2_bucket_to_apr_bucket(h2_bucket *bucket, 
+                                    apr_bucket_alloc_t *list);
+
 #endif /* defined(__mod_h2__h2_bucket__) */
@@ -0,0 +1,516 @@
+/* Copyright 2015 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_thread_mutex.h>
+
+#include <httpd.h>
+#include <http_core.h>
+#include <http_log.h>
+
+#include <nghttp2/nghttp2.h>
+
+#include "h2_private.h"
+#include "h2_cache.h"
+#include "h2_config.h"
+#include "h2_request.h"
+#include "h2_response.h"
+#include "h2_util.h"
+
+struct h2_cache_entry {
+    h2_cache_entry *prev;       /* more recently used entry */
+    h2_cache_entry *next;       /* less recently used entry */
+    const char *key;            /* scheme, authority and path */
+    nghttp2_nv *nv;             /* :status and headers, as stored */
+    apr_size_t nvlen;
+    const char *etag;           /* ETag header value or NULL */
+    const char *body;
+    apr_size_t body_len;
+    apr_time_t stored;          /* time the entry was stored */
+    apr_interval_time_t age;    /* Age of the response when stored */
+    apr_time_t expires;         /* time the entry becomes stale */
+    apr_size_t size;            /* bytes allocated for the entry */
+    int refs;                   /* the cache's and those of streams */
+};
+
+typedef struct {
+    apr_thread_mutex_t *lock;
+    apr_hash_t *entries;        /* key -> h2_cache_entry* */
+    h2_cache_entry *first;      /* most recently used */
+    h2_cache_entry *last;       /* least recently used, evicted first */
+    apr_size_t size;            /* bytes held by cached entries */
+    apr_size_t max_size;
+    apr_size_t max_entry_size;
+} h2_cache;
+
+struct h2_cache_fill {
+    h2_request *req;
+    h2_response *response;
+    const char *key;
+    apr_interval_time_t lifetime;
+    char *buffer;               /* malloc'ed, grows as the body arrives */
+    apr_size_t size;
+    apr_size_t len;
+    apr_size_t max_len;
+    int failed;                 /* body did not fit */
+};
+
+/* Size of a fill buffer when the body length is unknown, it doubles
+ * as needed, up to H2CacheMaxEntrySize. */
+#define H2_CACHE_FILL_SIZE      (8 * 1024)
+
+/* There is one cache per child, set up before any connection is served
+ * and left alone afterwards. NULL when disabled. */
+static h2_cache *cache;
+
+static void entry_unref(h2_cache_entry *entry)
+{
+    if (--entry->refs == 0) {
+        free(entry);
+    }
+}
+
+static void entry_unlink(h2_cache_entry *entry)
+{
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    }
+    else {
+        cache->first = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    }
+    else {
+        cache->last = entry->prev;
+    }
+    entry->prev = entry->next = NULL;
+}
+
+static void entry_link_first(h2_cache_entry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->first;
+    if (cache->first) {
+        cache->first->prev = entry;
+    }
+    cache->first = entry;
+    if (!cache->last) {
+        cache->last = entry;
+    }
+}
+
+/* Take the entry out of the cache, streams still serving it keep
+ * it alive. Call with the lock held. */
+static void entry_remove(h2_cache_entry *entry)
+{
+    apr_hash_set(cache->entries, entry->key, APR_HASH_KEY_STRING, NULL);
+    entry_unlink(entry);
+    cache->size -= entry->size;
+    entry_unref(entry);
+}
+
+static apr_status_t cache_cleanup(void *data)
+{
+    while (cache->last) {
+        entry_remove(cache->last);
+    }
+    cache = NULL;
+    return APR_SUCCESS;
+}
+
+apr_status_t h2_cache_child_init(apr_pool_t *pool, server_rec *s)
+{
+    h2_config *config = h2_config_sget(s);
+    int max_size = h2_config_geti(config, H2_CONF_CACHE_SIZE);
+    int max_entry_size = h2_config_geti(config, H2_CONF_CACHE_MAX_ENTRY_SIZE);
+
+    if (max_size <= 0 || max_entry_size <= 0) {
+        return APR_SUCCESS;
+    }
+
+    h2_cache *c = apr_pcalloc(pool, sizeof(h2_cache));
+    apr_status_t status = apr_thread_mutex_create(&c->lock,
+                                                  APR_THREAD_MUTEX_DEFAULT,
+                                                  pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    c->entries = apr_hash_make(pool);
+    c->max_size = max_size;
+    c->max_entry_size = max_entry_size;
+    cache = c;
+    apr_pool_cleanup_register(pool, c, cache_cleanup, apr_pool_cleanup_null);
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s,
+                 "h2_cache: %d bytes, entries up to %d bytes",
+                 max_size, max_entry_size);
+    return APR_SUCCESS;
+}
+
+static int may_use_cache(h2_request *req)
+{
+    return (cache && req->method && !strcmp("GET", req->method)
+            && req->authority && req->path
+            && !h2_request_get_cache_bypass(req));
+}
+
+static const char *get_key(h2_request *req)
+{
+    return apr_pstrcat(req->pool, req->scheme? req->scheme : "http", "://",
+                       req->authority, req->path, NULL);
+}
+
+h2_cache_entry *h2_cache_lookup(h2_request *req)
+{
+    if (!may_use_cache(req)) {
+        return NULL;
+    }
+
+    h2_cache_entry *entry = NULL;
+    const char *key = get_key(req);
+    apr_status_t status = apr_thread_mutex_lock(cache->lock);
+    if (APR_SUCCESS == status) {
+        entry = apr_hash_get(cache->entries, key, APR_HASH_KEY_STRING);
+        if (entry) {
+            if (apr_time_now() >= entry->expires) {
+                entry_remove(entry);
+                entry = NULL;
+            }
+            else {
+                ++entry->refs;
+                entry_unlink(entry);
+                entry_link_first(entry);
+            }
+        }
+        apr_thread_mutex_unlock(cache->lock);
+    }
+    return entry;
+}
+
+void h2_cache_release(h2_cache_entry *entry)
+{
+    apr_status_t status = apr_thread_mutex_lock(cache->lock);
+    if (APR_SUCCESS == status) {
+        entry_unref(entry);
+        apr_thread_mutex_unlock(cache->lock);
+    }
+}
+
+/* Return != 0 iff the If-None-Match value lists the entity tag, using
+ * the weak comparison of RFC 7232, ch. 2.3.2. */
+static int etag_match(const char *list, const char *etag)
+{
+    if (!strcmp("*", list)) {
+        return 1;
+    }
+    if (!strncmp("W/", etag, 2)) {
+        etag += 2;
+    }
+    apr_size_t elen = strlen(etag);
+    const char *s = list;
+    while (*s) {
+        while (*s == ' ' || *s == '\t' || *s == ',') {
+            ++s;
+        }
+        if (!strncmp("W/", s, 2)) {
+            s += 2;
+        }
+        const char *end = (*s == '"')? strchr(s + 1, '"') : NULL;
+        if (!end) {
+            return 0;
+        }
+        ++end;
+        if ((apr_size_t)(end - s) == elen && !strncmp(s, etag, elen)) {
+            return 1;
+        }
+        s = end;
+    }
+    return 0;
+}
+
+apr_status_t h2_cache_serve(h2_cache_entry *entry, h2_request *req,
+                            int stream_id, apr_pool_t *pool,
+                            apr_bucket_brigade *bb,
+                            h2_response **presponse)
+{
+    const char *inm = h2_request_get_if_none_match(req);
+    int not_modified = (inm && entry->etag && etag_match(inm, entry->etag));
+
+    h2_response *response = apr_pcalloc(pool, sizeof(h2_response));
+    response->stream_id = stream_id;
+    response->task_status = APR_SUCCESS;
+    response->http_status = not_modified? "304" : (const char *)entry->nv[0].value;
+    response->content_length = not_modified? -1 : (long)entry->body_len;
+    response->headers = apr_table_make(pool, entry->nvlen);
+    response->nv = apr_palloc(pool, (entry->nvlen + 1) * sizeof(nghttp2_nv));
+
+    /* nv[0] is :status, headers follow */
+    nghttp2_nv *nv = response->nv;
+    H2_CREATE_NV_LIT_CS(nv, ":status", response->http_status);
+    nv->flags = NGHTTP2_NV_FLAG_NONE;
+    for (int i = 1; i < entry->nvlen; ++i) {
+        const char *name = (const char *)entry->nv[i].name;
+        if (not_modified && H2_HD_MATCH_LIT_CS("content-length", name)) {
+            continue;
+        }
+        *(++nv) = entry->nv[i];
+        apr_table_addn(response->headers, name,
+                       (const char *)entry->nv[i].value);
+    }
+    /* we are a cache, tell the client how old the response is: the
+     * age it had when stored plus the time we held it, RFC 7234 ch. 4.2.3.
+     * The stored Age header has been left out of the entry. */
+    const char *age = apr_psprintf(pool, "%ld", (long)apr_time_sec(
+                                   entry->age + apr_time_now() - entry->stored));
+    ++nv;
+    H2_CREATE_NV_LIT_CS(nv, "age", age);
+    nv->flags = NGHTTP2_NV_FLAG_NONE;
+    response->nvlen = (nv - response->nv) + 1;
+
+    if (!not_modified && entry->body_len > 0) {
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_immortal_create(entry->body,
+                                                               entry->body_len,
+                                                               bb->bucket_alloc));
+    }
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(bb->bucket_alloc));
+
+    *presponse = response;
+    return APR_SUCCESS;
+}
+
+/* Get the number of seconds a shared cache may consider the response
+ * fresh from its Cache-Control, RFC 7234 ch. 5.2.2. Return 0 if it
+ * must not be stored or has no explicit lifetime. */
+static apr_interval_time_t get_lifetime(apr_pool_t *pool, const char *cc)
+{
+    apr_int64_t max_age = 0, s_maxage = -1;
+    char *last = NULL;
+
+    for (char *tok = apr_strtok(apr_pstrdup(pool, cc), ",", &last); tok;
+         tok = apr_strtok(NULL, ",", &last)) {
+        while (*tok == ' ' || *tok == '\t') {
+            ++tok;
+        }
+        char *val = strchr(tok, '=');
+        apr_size_t nlen = val? (apr_size_t)(val - tok) : strlen(tok);
+        while (nlen > 0 && (tok[nlen-1] == ' ' || tok[nlen-1] == '\t')) {
+            --nlen;
+        }
+        if (val) {
+            ++val;
+            if (*val == '"') {
+                ++val;
+            }
+        }
+        if (H2_HD_MATCH_LIT("no-store", tok, nlen)
+            || H2_HD_MATCH_LIT("no-cache", tok, nlen)
+            || H2_HD_MATCH_LIT("private", tok, nlen)) {
+            return 0;
+        }
+        if (val && H2_HD_MATCH_LIT("max-age", tok, nlen)) {
+            max_age = apr_atoi64(val);
+        }
+        else if (val && H2_HD_MATCH_LIT("s-maxage", tok, nlen)) {
+            s_maxage = apr_atoi64(val);
+        }
+    }
+    if (s_maxage >= 0) {
+        max_age = s_maxage;
+    }
+    return (max_age > 0)? apr_time_from_sec(max_age) : 0;
+}
+
+static apr_status_t fill_cleanup(void *data)
+{
+    h2_cache_fill *fill = data;
+    if (fill->buffer) {
+        free(fill->buffer);
+        fill->buffer = NULL;
+    }
+    return APR_SUCCESS;
+}
+
+h2_cache_fill *h2_cache_fill_create(h2_request *req, h2_response *response,
+                                    apr_pool_t *pool)
+{
+    if (!may_use_cache(req) || !response->http_status
+        || strcmp("200", response->http_status)
+        || response->content_length > (long)cache->max_entry_size) {
+        return NULL;
+    }
+
+    const char *cc = apr_table_get(response->headers, "Cache-Control");
+    if (!cc
+        || apr_table_get(response->headers, "Set-Cookie")
+        || apr_table_get(response->headers, "Vary")) {
+        return NULL;
+    }
+    apr_interval_time_t lifetime = get_lifetime(pool, cc);
+    if (lifetime <= 0) {
+        return NULL;
+    }
+
+    h2_cache_fill *fill = apr_pcalloc(pool, sizeof(h2_cache_fill));
+    fill->req = req;
+    fill->response = response;
+    fill->key = get_key(req);
+    fill->lifetime = lifetime;
+    fill->max_len = ((response->content_length >= 0)?
+                     response->content_length : cache->max_entry_size);
+    apr_pool_cleanup_register(pool, fill, fill_cleanup, apr_pool_cleanup_null);
+    return fill;
+}
+
+void h2_cache_fill_add(h2_cache_fill *fill, const char *data, apr_size_t len)
+{
+    if (fill->failed || len > fill->max_len - fill->len) {
+        fill->failed = 1;
+        return;
+    }
+    if (len > fill->size - fill->len) {
+        /* a response of known length gets its buffer at once */
+        apr_size_t size = ((fill->response->content_length >= 0)? 
+                           fill->max_len : H2_CACHE_FILL_SIZE);
+        while (size < fill->len + len) {
+            size *= 2;
+        }
+        if (size > fill->max_len) {
+            size = fill->max_len;
+        }
+        char *buffer = realloc(fill->buffer, size);
+        if (!buffer) {
+            fill->failed = 1;
+            return;
+        }
+        fill->buffer = buffer;
+        fill->size = size;
+    }
+    memcpy(fill->buffer + fill->len, data, len);
+    fill->len += len;
+}
+
+static h2_cache_entry *entry_create(h2_cache_fill *fill)
+{
+    h2_response *response = fill->response;
+    apr_size_t klen = strlen(fill->key);
+    apr_interval_time_t age = 0;
+
+    /* one block holds the entry, its header vector and all strings */
+    apr_size_t total = sizeof(h2_cache_entry) + klen + 1 + fill->len;
+    total += response->nvlen * sizeof(nghttp2_nv);
+    for (int i = 0; i < response->nvlen; ++i) {
+        total += response->nv[i].namelen + response->nv[i].valuelen + 2;
+    }
+    if (total > cache->max_size) {
+        return NULL;
+    }
+
+    h2_cache_entry *entry = calloc(1, total);
+    if (!entry) {
+        return NULL;
+    }
+    entry->size = total;
+    entry->refs = 1;
+    entry->nv = (nghttp2_nv *)(entry + 1);
+    entry->nvlen = 0;
+
+    char *s = (char *)(entry->nv + response->nvlen);
+    for (int i = 0; i < response->nvlen; ++i) {
+        const nghttp2_nv *src = &response->nv[i];
+        if (H2_HD_MATCH_LIT("age", (const char *)src->name, src->namelen)) {
+            /* an upstream cache held it, we add our time when serving */
+            age = apr_time_from_sec(apr_atoi64(apr_pstrndup(
+                fill->req->pool, (const char *)src->value, src->valuelen)));
+            continue;
+        }
+        nghttp2_nv *nv = &entry->nv[entry->nvlen++];
+        *nv = *src;
+        nv->name = (uint8_t *)s;
+        memcpy(s, src->name, src->namelen);
+        s += src->namelen + 1;
+        nv->value = (uint8_t *)s;
+        memcpy(s, src->value, src->valuelen);
+        s += src->valuelen + 1;
+        if (H2_HD_MATCH_LIT("etag", (const char *)nv->name, nv->namelen)) {
+            entry->etag = (const char *)nv->value;
+        }
+    }
+    entry->key = s;
+    memcpy(s, fill->key, klen);
+    s += klen + 1;
+    entry->body = s;
+    entry->body_len = fill->len;
+    if (fill->len > 0) {
+        memcpy(s, fill->buffer, fill->len);
+    }
+
+    entry->stored = apr_time_now();
+    entry->age = (age > 0)? age : 0;
+    /* fresh as long as its age is below the lifetime */
+    entry->expires = entry->stored + fill->lifetime - entry->age;
+    return entry;
+}
+
+static void fill_store(h2_cache_fill *fill)
+{
+    if (fill->failed || (fill->response->content_length >= 0
+                         && fill->len != (apr_size_t)fill->response->content_length)) {
+        return;
+    }
+
+    h2_cache_entry *entry = entry_create(fill);
+    if (!entry) {
+        return;
+    }
+    if (entry->expires <= entry->stored) {
+        /* stale already */
+        free(entry);
+        return;
+    }
+
+    apr_status_t status = apr_thread_mutex_lock(cache->lock);
+    if (APR_SUCCESS == status) {
+        h2_cache_entry *old = apr_hash_get(cache->entries, entry->key,
+                                           APR_HASH_KEY_STRING);
+        if (old) {
+            entry_remove(old);
+        }
+        while (cache->last && cache->size + entry->size > cache->max_size) {
+            entry_remove(cache->last);
+        }
+        apr_hash_set(cache->entries, entry->key, APR_HASH_KEY_STRING, entry);
+        entry_link_first(entry);
+        cache->size += entry->size;
+        ap_log_perror(APLOG_MARK, APLOG_DEBUG, 0, fill->req->pool,
+                      "h2_cache: stored %s (%ld body bytes), %ld bytes in use",
+                      entry->key, (long)entry->body_len, (long)cache->size);
+        apr_thread_mutex_unlock(cache->lock);
+    }
+    else {
+        free(entry);
+    }
+}
+
+void h2_cache_fill_end(h2_cache_fill *fill)
+{
+    fill_store(fill);
+    /* the entry has its own copy */
+    fill_cleanup(fill);
+}
@@ -0,0 +1,88 @@
+/* Copyright 2015 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __mod_h2__h2_cache__
+#define __mod_h2__h2_cache__
+
+/**
+ * A small cache of hot responses, shared by all sessions of a child
+ * process. Small GET responses that are explicitly fresh (Cache-Control
+ * max-age or s-maxage) are kept with their prebuilt header vector and
+ * body. Requests hitting the cache are answered by the session itself,
+ * no h2_task is created for them.
+ *
+ * Entries are reference counted. A stream serving an entry holds a
+ * reference until it is destroyed, so evicting an entry never pulls
+ * the body away from a response still being sent.
+ */
+struct h2_request;
+struct h2_response;
+
+typedef struct h2_cache_entry h2_cache_entry;
+typedef struct h2_cache_fill h2_cache_fill;
+
+/**
+ * Set up the cache of the child process, if H2CacheSize is configured.
+ */
+apr_status_t h2_cache_child_init(apr_pool_t *pool, server_rec *s);
+
+/**
+ * Look up a fresh entry that may answer the request.
+ * @param req the request, complete with all headers
+ * @return the entry with a reference held by the caller, NULL on a miss
+ */
+h2_cache_entry *h2_cache_lookup(struct h2_request *req);
+
+/**
+ * Give up a reference obtained by h2_cache_lookup().
+ */
+void h2_cache_release(h2_cache_entry *entry);
+
+/**
+ * Make the response for the request from the entry. This is a 304 if
+ * the request's If-None-Match matches the entry's ETag. The body
+ * buckets refer to the entry's memory and need the reference to be
+ * held until they are gone.
+ * @param entry the entry to serve
+ * @param req the request to answer
+ * @param stream_id the stream the response is for
+ * @param pool the pool to allocate the response in
+ * @param bb the brigade to add body and EOS to
+ * @param presponse on return, the response
+ */
+apr_status_t h2_cache_serve(h2_cache_entry *entry, struct h2_request *req,
+                            int stream_id, apr_pool_t *pool,
+                            apr_bucket_brigade *bb,
+                            struct h2_response **presponse);
+
+/**
+ * Start collecting the body of a response for storing it in the cache.
+ * @return the fill or NULL if the response may not be stored
+ */
+h2_cache_fill *h2_cache_fill_create(struct h2_request *req,
+                                    struct h2_response *response,
+                                    apr_pool_t *pool);
+
+/**
+ * Add body bytes of the response as they are sent.
+ */
+void h2_cache_fill_add(h2_cache_fill *fill, const char *data, apr_size_t len);
+
+/**
+ * The response body is complete, store it if it has been collected in full.
+ */
+void h2_cache_fill_end(h2_cache_fill *fill);
+
+#endif /* defined(__mod_h2__h2_cache__) */
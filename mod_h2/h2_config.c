@@ -27,6 +27,7 @@
 #include "h2_ctx.h"
 #include "h2_config.h"
 #include "h2_private.h"
+#include "h2_version.h"
 
 #define DEF_VAL     (-1)
 
@@ -45,6 +46,29 @@ static h2_config defconf = {
     64 * 1024,        /* stream max mem size */
     NULL,             /* no alt-svcs */
     -1,               /* alt-svc max age */
+    64 * 1024,        /* stream max input mem size */
+    1024 * 1024,      /* session max input mem size */
+    0,                /* defer body max size, off */
+    4096,             /* hpack deflate table size */
+    4096,             /* hpack inflate table size */
+    NULL,             /* index all headers */
+    0,                /* push enabled */
+    256,              /* push diary size */
+    0,                /* response cache size, off */
+    16 * 1024,        /* response cache max entry size */
+    NULL,             /* no inline locations */
+    NULL,             /* no collapse locations */
+    8 * 1024,         /* stream flush size */
+    100,              /* stream flush interval, ms */
+    0,                /* stream max spool size, off */
+    60,               /* stream send timeout, secs */
+    60,               /* stream receive timeout, secs */
+    0,                /* stream min send rate, off */
+    0,                /* unlimited */
+    0,                /* unlimited */
+    0,                /* system default */
+    5,                /* seconds */
+    1024 * 1024,      /* session max mem size */
 };
 
 static void *h2_config_create(apr_pool_t *pool,
@@ -69,6 +93,26 @@ static void *h2_config_create(apr_pool_t *pool,
     conf->max_worker_idle_secs = DEF_VAL;
     conf->stream_max_mem_size = DEF_VAL;
     conf->alt_svc_max_age = DEF_VAL;
+    conf->stream_max_in_mem_size = DEF_VAL;
+    conf->session_max_in_mem_size = DEF_VAL;
+    conf->defer_body_max_size = DEF_VAL;
+    conf->hpack_deflate_size = DEF_VAL;
+    conf->hpack_inflate_size = DEF_VAL;
+    conf->h2_push        = DEF_VAL;
+    conf->push_diary_size = DEF_VAL;
+    conf->cache_size     = DEF_VAL;
+    conf->cache_max_entry_size = DEF_VAL;
+    conf->stream_flush_size = DEF_VAL;
+    conf->stream_flush_msecs = DEF_VAL;
+    conf->stream_max_spool_size = DEF_VAL;
+    conf->stream_send_timeout = DEF_VAL;
+    conf->stream_recv_timeout = DEF_VAL;
+    conf->stream_min_send_rate = DEF_VAL;
+    conf->worker_max_mem_free = DEF_VAL;
+    conf->session_max_mem_free = DEF_VAL;
+    conf->worker_stack_size = DEF_VAL;
+    conf->idle_shed_secs = DEF_VAL;
+    conf->session_max_mem_size = DEF_VAL;
     return conf;
 }
 
@@ -107,6 +151,32 @@ void *h2_config_merge(apr_pool_t *pool, void *basev, void *addv)
     n->stream_max_mem_size = H2_CONFIG_GET(add, base, stream_max_mem_size);
     n->alt_svcs = add->alt_svcs? add->alt_svcs : base->alt_svcs;
     n->alt_svc_max_age = H2_CONFIG_GET(add, base, alt_svc_max_age);
+    n->stream_max_in_mem_size = H2_CONFIG_GET(add, base, stream_max_in_mem_size);
+    n->session_max_in_mem_size = H2_CONFIG_GET(add, base, session_max_in_mem_size);
+    n->defer_body_max_size = H2_CONFIG_GET(add, base, defer_body_max_size);
+    n->hpack_deflate_size = H2_CONFIG_GET(add, base, hpack_deflate_size);
+    n->hpack_inflate_size = H2_CONFIG_GET(add, base, hpack_inflate_size);
+    n->hpack_never_index = (add->hpack_never_index? 
+                            add->hpack_never_index : base->hpack_never_index);
+    n->h2_push        = H2_CONFIG_GET(add, base, h2_push);
+    n->push_diary_size = H2_CONFIG_GET(add, base, push_diary_size);
+    n->cache_size     = H2_CONFIG_GET(add, base, cache_size);
+    n->cache_max_entry_size = H2_CONFIG_GET(add, base, cache_max_entry_size);
+    n->inline_locations = (add->inline_locations? 
+                           add->inline_locations : base->inline_locations);
+    n->collapse_locations = (add->collapse_locations? 
+                             add->collapse_locations : base->collapse_locations);
+    n->stream_flush_size = H2_CONFIG_GET(add, base, stream_flush_size);
+    n->stream_flush_msecs = H2_CONFIG_GET(add, base, stream_flush_msecs);
+    n->stream_max_spool_size = H2_CONFIG_GET(add, base, stream_max_spool_size);
+    n->stream_send_timeout = H2_CONFIG_GET(add, base, stream_send_timeout);
+    n->stream_recv_timeout = H2_CONFIG_GET(add, base, stream_recv_timeout);
+    n->stream_min_send_rate = H2_CONFIG_GET(add, base, stream_min_send_rate);
+    n->worker_max_mem_free = H2_CONFIG_GET(add, base, worker_max_mem_free);
+    n->session_max_mem_free = H2_CONFIG_GET(add, base, session_max_mem_free);
+    n->worker_stack_size = H2_CONFIG_GET(add, base, worker_stack_size);
+    n->idle_shed_secs = H2_CONFIG_GET(add, base, idle_shed_secs);
+    n->session_max_mem_size = H2_CONFIG_GET(add, base, session_max_mem_size);
     
     return n;
 }
@@ -132,6 +202,46 @@ int h2_config_geti(h2_config *conf, h2_config_var_t var)
             return H2_CONFIG_GET(conf, &defconf, stream_max_mem_size);
         case H2_CONF_ALT_SVC_MAX_AGE:
             return H2_CONFIG_GET(conf, &defconf, alt_svc_max_age);
+        case H2_CONF_STREAM_MAX_IN_MEM_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, stream_max_in_mem_size);
+        case H2_CONF_SESSION_MAX_IN_MEM_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, session_max_in_mem_size);
+        case H2_CONF_DEFER_BODY_MAX_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, defer_body_max_size);
+        case H2_CONF_HPACK_DEFLATE_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, hpack_deflate_size);
+        case H2_CONF_HPACK_INFLATE_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, hpack_inflate_size);
+        case H2_CONF_PUSH:
+            return H2_CONFIG_GET(conf, &defconf, h2_push);
+        case H2_CONF_PUSH_DIARY_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, push_diary_size);
+        case H2_CONF_CACHE_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, cache_size);
+        case H2_CONF_CACHE_MAX_ENTRY_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, cache_max_entry_size);
+        case H2_CONF_STREAM_FLUSH_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, stream_flush_size);
+        case H2_CONF_STREAM_FLUSH_MSECS:
+            return H2_CONFIG_GET(conf, &defconf, stream_flush_msecs);
+        case H2_CONF_STREAM_MAX_SPOOL_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, stream_max_spool_size);
+        case H2_CONF_STREAM_SEND_TIMEOUT:
+            return H2_CONFIG_GET(conf, &defconf, stream_send_timeout);
+        case H2_CONF_STREAM_RECV_TIMEOUT:
+            return H2_CONFIG_GET(conf, &defconf, stream_recv_timeout);
+        case H2_CONF_STREAM_MIN_SEND_RATE:
+            return H2_CONFIG_GET(conf, &defconf, stream_min_send_rate);
+        case H2_CONF_WORKER_MAX_MEM_FREE:
+            return H2_CONFIG_GET(conf, &defconf, worker_max_mem_free);
+        case H2_CONF_SESSION_MAX_MEM_FREE:
+            return H2_CONFIG_GET(conf, &defconf, session_max_mem_free);
+        case H2_CONF_WORKER_STACK_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, worker_stack_size);
+        case H2_CONF_IDLE_SHED_SECS:
+            return H2_CONFIG_GET(conf, &defconf, idle_shed_secs);
+        case H2_CONF_SESSION_MAX_MEM_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, session_max_mem_size);
         default:
             return DEF_VAL;
     }
@@ -228,6 +338,220 @@ static const char *h2_conf_set_alt_svc_max_age(cmd_parms *parms,
     return NULL;
 }
 
+static const char *h2_conf_set_stream_max_in_mem_size(cmd_parms *parms,
+                                                      void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->stream_max_in_mem_size = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_conf_set_session_max_in_mem_size(cmd_parms *parms,
+                                                       void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->session_max_in_mem_size = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_conf_set_defer_body_max_size(cmd_parms *parms,
+                                                   void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->defer_body_max_size = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_conf_set_hpack_deflate_size(cmd_parms *parms,
+                                                  void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+#if NGHTTP2_HAS_DEFLATE_TABLE_SIZE
+    cfg->hpack_deflate_size = (int)apr_atoi64(value);
+#else
+    ap_log_error(APLOG_MARK, APLOG_WARNING, 0, parms->server,
+                 "H2HpackDeflateTableSize ignored, needs mod_h2 built "
+                 "with nghttp2 >= 1.11");
+#endif
+    return NULL;
+}
+
+static const char *h2_conf_set_hpack_inflate_size(cmd_parms *parms,
+                                                  void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->hpack_inflate_size = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_add_hpack_never_index(cmd_parms *parms,
+                                            void *arg, const char *value)
+{
+    if (value && strlen(value)) {
+        h2_config *cfg = h2_config_sget(parms->server);
+        if (!cfg->hpack_never_index) {
+            cfg->hpack_never_index = apr_array_make(parms->pool, 5, 
+                                                    sizeof(const char*));
+        }
+        APR_ARRAY_PUSH(cfg->hpack_never_index, const char*) = value;
+    }
+    return NULL;
+}
+
+static const char *h2_conf_set_push(cmd_parms *parms,
+                                    void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->h2_push = !apr_strnatcasecmp(value, "On");
+    return NULL;
+}
+
+static const char *h2_conf_set_push_diary_size(cmd_parms *parms,
+                                               void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->push_diary_size = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_conf_set_cache_size(cmd_parms *parms,
+                                          void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->cache_size = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_conf_set_cache_max_entry_size(cmd_parms *parms,
+                                                    void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->cache_max_entry_size = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_add_inline_location(cmd_parms *parms,
+                                          void *arg, const char *value)
+{
+    if (value && strlen(value)) {
+        if (value[0] != '/') {
+            return "inline location must be an absolute path";
+        }
+        h2_config *cfg = h2_config_sget(parms->server);
+        if (!cfg->inline_locations) {
+            cfg->inline_locations = apr_array_make(parms->pool, 5, 
+                                                   sizeof(const char*));
+        }
+        APR_ARRAY_PUSH(cfg->inline_locations, const char*) = value;
+    }
+    return NULL;
+}
+
+static const char *h2_add_collapse_location(cmd_parms *parms,
+                                            void *arg, const char *value)
+{
+    if (value && strlen(value)) {
+        if (value[0] != '/') {
+            return "collapse location must be an absolute path";
+        }
+        h2_config *cfg = h2_config_sget(parms->server);
+        if (!cfg->collapse_locations) {
+            cfg->collapse_locations = apr_array_make(parms->pool, 5, 
+                                                     sizeof(const char*));
+        }
+        APR_ARRAY_PUSH(cfg->collapse_locations, const char*) = value;
+    }
+    return NULL;
+}
+
+static const char *h2_conf_set_stream_flush_size(cmd_parms *parms,
+                                                 void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->stream_flush_size = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_conf_set_stream_flush_msecs(cmd_parms *parms,
+                                                  void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->stream_flush_msecs = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_conf_set_stream_max_spool_size(cmd_parms *parms,
+                                                     void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->stream_max_spool_size = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_conf_set_stream_send_timeout(cmd_parms *parms,
+                                                   void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->stream_send_timeout = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_conf_set_stream_recv_timeout(cmd_parms *parms,
+                                                   void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->stream_recv_timeout = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_conf_set_stream_min_send_rate(cmd_parms *parms,
+                                                    void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->stream_min_send_rate = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_conf_set_worker_max_mem_free(cmd_parms *parms,
+                                                   void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->worker_max_mem_free = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_conf_set_session_max_mem_free(cmd_parms *parms,
+                                                    void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->session_max_mem_free = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_conf_set_worker_stack_size(cmd_parms *parms,
+                                                 void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->worker_stack_size = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_conf_set_idle_shed_secs(cmd_parms *parms,
+                                              void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->idle_shed_secs = (int)apr_atoi64(value);
+    return NULL;
+}
+
+static const char *h2_conf_set_session_max_mem_size(cmd_parms *parms,
+                                                    void *arg, const char *value)
+{
+    h2_config *cfg = h2_config_sget(parms->server);
+    cfg->session_max_mem_size = (int)apr_atoi64(value);
+    return NULL;
+}
+
 const command_rec h2_cmds[] = {
     AP_INIT_TAKE1("H2Engine", h2_conf_set_engine, NULL,
                   RSRC_CONF, "on to enable HTTP/2 protocol handling"),
@@ -249,6 +573,52 @@ const command_rec h2_cmds[] = {
                   RSRC_CONF, "adds an Alt-Svc for this server"),
     AP_INIT_TAKE1("H2AltSvcMaxAge", h2_conf_set_alt_svc_max_age, NULL,
                   RSRC_CONF, "set the maximum age (in seconds) that client can rely on alt-svc information"),
+    AP_INIT_TAKE1("H2StreamMaxInputMemSize", h2_conf_set_stream_max_in_mem_size, NULL,
+                  RSRC_CONF, "maximum number of request body bytes queued in memory for a stream"),
+    AP_INIT_TAKE1("H2SessionMaxInputMemSize", h2_conf_set_session_max_in_mem_size, NULL,
+                  RSRC_CONF, "maximum number of request body bytes queued in memory for a session"),
+    AP_INIT_TAKE1("H2DeferBodyMaxSize", h2_conf_set_defer_body_max_size, NULL,
+                  RSRC_CONF, "request bodies up to this size are received completely before the request is processed"),
+    AP_INIT_TAKE1("H2HpackDeflateTableSize", h2_conf_set_hpack_deflate_size, NULL,
+                  RSRC_CONF, "maximum size of the HPACK dynamic table used for response headers"),
+    AP_INIT_TAKE1("H2HpackInflateTableSize", h2_conf_set_hpack_inflate_size, NULL,
+                  RSRC_CONF, "size of the HPACK dynamic table offered to clients for request headers"),
+    AP_INIT_ITERATE("H2HpackNeverIndex", h2_add_hpack_never_index, NULL,
+                  RSRC_CONF, "response header names that are never added to the HPACK table"),
+    AP_INIT_TAKE1("H2Push", h2_conf_set_push, NULL,
+                  RSRC_CONF, "on to push resources announced via Link rel=preload headers"),
+    AP_INIT_TAKE1("H2PushDiarySize", h2_conf_set_push_diary_size, NULL,
+                  RSRC_CONF, "number of pushed resources a session remembers to not push them again"),
+    AP_INIT_TAKE1("H2CacheSize", h2_conf_set_cache_size, NULL,
+                  RSRC_CONF, "maximum number of bytes of small responses cached per child process"),
+    AP_INIT_TAKE1("H2CacheMaxEntrySize", h2_conf_set_cache_max_entry_size, NULL,
+                  RSRC_CONF, "maximum size of a response body to be cached"),
+    AP_INIT_ITERATE("H2InlineLocation", h2_add_inline_location, NULL,
+                  RSRC_CONF, "locations whose requests may be processed on the connection thread instead of a worker"),
+    AP_INIT_ITERATE("H2CollapseLocation", h2_add_collapse_location, NULL,
+                  RSRC_CONF, "locations where identical concurrent GET requests are answered by a single task"),
+    AP_INIT_TAKE1("H2StreamFlushSize", h2_conf_set_stream_flush_size, NULL,
+                  RSRC_CONF, "number of response bytes a handler may produce before they are passed on without an explicit flush"),
+    AP_INIT_TAKE1("H2StreamFlushInterval", h2_conf_set_stream_flush_msecs, NULL,
+                  RSRC_CONF, "milliseconds a handler's response output may be held before it is passed on without an explicit flush"),
+    AP_INIT_TAKE1("H2StreamMaxSpoolSize", h2_conf_set_stream_max_spool_size, NULL,
+                  RSRC_CONF, "maximum number of response bytes of a stream written to a temporary file when a client reads slower than the stream's handler writes"),
+    AP_INIT_TAKE1("H2StreamSendTimeout", h2_conf_set_stream_send_timeout, NULL,
+                  RSRC_CONF, "seconds a stream's handler waits for the client to take more of its response before the stream is reset"),
+    AP_INIT_TAKE1("H2StreamReceiveTimeout", h2_conf_set_stream_recv_timeout, NULL,
+                  RSRC_CONF, "seconds a stream's handler waits for more of the request body before the stream is reset"),
+    AP_INIT_TAKE1("H2StreamMinSendRate", h2_conf_set_stream_min_send_rate, NULL,
+                  RSRC_CONF, "minimum number of response bytes per second a client needs to read while the stream's handler waits for it"),
+    AP_INIT_TAKE1("H2WorkerMaxMemFree", h2_conf_set_worker_max_mem_free, NULL,
+                  RSRC_CONF, "KBytes of free memory a worker thread's allocator keeps for reuse, 0 for no limit"),
+    AP_INIT_TAKE1("H2SessionMaxMemFree", h2_conf_set_session_max_mem_free, NULL,
+                  RSRC_CONF, "KBytes of free memory the allocator of a session's stream buffers keeps for reuse, 0 for no limit"),
+    AP_INIT_TAKE1("H2WorkerStackSize", h2_conf_set_worker_stack_size, NULL,
+                  RSRC_CONF, "bytes of stack for each worker thread, 0 for the system default"),
+    AP_INIT_TAKE1("H2IdleShedSeconds", h2_conf_set_idle_shed_secs, NULL,
+                  RSRC_CONF, "seconds a connection without open streams waits before it frees memory only needed for active streams, 0 to disable"),
+    AP_INIT_TAKE1("H2SessionMaxMemSize", h2_conf_set_session_max_mem_size, NULL,
+                  RSRC_CONF, "maximum number of response bytes buffered in memory for all streams of a session"),
     {NULL}
 };
 
@@ -34,6 +34,26 @@ typedef enum {
     H2_CONF_STREAM_MAX_MEM_SIZE,
     H2_CONF_ALT_SVCS,
     H2_CONF_ALT_SVC_MAX_AGE,
+    H2_CONF_STREAM_MAX_IN_MEM_SIZE,
+    H2_CONF_SESSION_MAX_IN_MEM_SIZE,
+    H2_CONF_DEFER_BODY_MAX_SIZE,
+    H2_CONF_HPACK_DEFLATE_SIZE,
+    H2_CONF_HPACK_INFLATE_SIZE,
+    H2_CONF_PUSH,
+    H2_CONF_PUSH_DIARY_SIZE,
+    H2_CONF_CACHE_SIZE,
+    H2_CONF_CACHE_MAX_ENTRY_SIZE,
+    H2_CONF_STREAM_FLUSH_SIZE,
+    H2_CONF_STREAM_FLUSH_MSECS,
+    H2_CONF_STREAM_MAX_SPOOL_SIZE,
+    H2_CONF_STREAM_SEND_TIMEOUT,
+    H2_CONF_STREAM_RECV_TIMEOUT,
+    H2_CONF_STREAM_MIN_SEND_RATE,
+    H2_CONF_WORKER_MAX_MEM_FREE,
+    H2_CONF_SESSION_MAX_MEM_FREE,
+    H2_CONF_WORKER_STACK_SIZE,
+    H2_CONF_IDLE_SHED_SECS,
+    H2_CONF_SESSION_MAX_MEM_SIZE,
 } h2_config_var_t;
 
 /* Apache httpd module configuration for h2. */
@@ -49,6 +69,31 @@ typedef struct h2_config {
     int stream_max_mem_size;      /* max # bytes held in memory/stream */
     apr_array_header_t *alt_svcs; /* h2_alt_svc specs for this server */
     int alt_svc_max_age;          /* how long clients can rely on alt-svc info (seconds) */
+    int stream_max_in_mem_size;   /* max # input bytes queued/stream */
+    int session_max_in_mem_size;  /* max # input bytes queued/session */
+    int defer_body_max_size;      /* max request body size that is received
+                                   * completely before task dispatch */
+    int hpack_deflate_size;       /* max HPACK table size for responses */
+    int hpack_inflate_size;       /* HPACK table size offered for requests */
+    apr_array_header_t *hpack_never_index; /* header names never to index */
+    int h2_push;                  /* if link preload headers trigger pushes */
+    int push_diary_size;          /* # of pushed resources remembered/session */
+    int cache_size;               /* max # bytes of cached responses/child */
+    int cache_max_entry_size;     /* max # bytes of a cached response */
+    apr_array_header_t *inline_locations; /* paths run on the session thread */
+    apr_array_header_t *collapse_locations; /* paths where identical GETs
+                                             * share one task */
+    int stream_flush_size;        /* # response bytes held before passing on */
+    int stream_flush_msecs;       /* max ms response bytes are held */
+    int stream_max_spool_size;    /* max # output bytes spooled/stream */
+    int stream_send_timeout;      /* max secs a task waits for drain */
+    int stream_recv_timeout;      /* max secs a task waits for input */
+    int stream_min_send_rate;     /* min bytes/sec a client reads a response */
+    int worker_max_mem_free;      /* KB a worker's allocator keeps */
+    int session_max_mem_free;     /* KB a session's allocator keeps */
+    int worker_stack_size;        /* stack size of worker threads */
+    int idle_shed_secs;           /* secs idle before freeing stream state */
+    int session_max_mem_size;     /* max response bytes in memory per session */
 } h2_config;
 
 
@@ -28,10 +28,13 @@
 #include "h2_private.h"
 #include "h2_config.h"
 #include "h2_ctx.h"
+#include "h2_mplx.h"
+#include "h2_request.h"
 #include "h2_session.h"
 #include "h2_stream.h"
 #include "h2_stream_set.h"
 #include "h2_task.h"
+#include "h2_util.h"
 #include "h2_worker.h"
 #include "h2_workers.h"
 #include "h2_conn.h"
@@ -54,6 +57,9 @@ apr_status_t h2_conn_child_init(apr_pool_t *pool, server_rec *s)
     apr_status_t status = APR_SUCCESS;
     int minw = h2_config_geti(config, H2_CONF_MIN_WORKERS);
     int maxw = h2_config_geti(config, H2_CONF_MAX_WORKERS);
+    apr_size_t stack_size = h2_config_geti(config, H2_CONF_WORKER_STACK_SIZE);
+    apr_size_t max_mem_free = 1024 * (apr_size_t)h2_config_geti(config, 
+                                          H2_CONF_WORKER_MAX_MEM_FREE);
     
     int max_threads_per_child = 0;
     ap_mpm_query(AP_MPMQ_MAX_THREADS, &max_threads_per_child);
@@ -75,9 +81,11 @@ apr_status_t h2_conn_child_init(apr_pool_t *pool, server_rec *s)
     ap_log_error(APLOG_MARK, APLOG_INFO, 0, s,
                  "h2_conn: child init with conf[%s]: "
                  "min_workers=%d, max_workers=%d, "
+                 "worker_stack_size=%ld, worker_max_mem_free=%ld, "
                  "mpm-threads=%d, mpm-threads-limit=%d, "
                  "mpm-type=%d(%s)",
                  config->name, config->min_workers, config->max_workers,
+                 (long)stack_size, (long)max_mem_free,
                  max_threads_per_child, threads_limit, mpm_type,
                  mpm_module? mpm_module->name : "unknown");
     
@@ -90,9 +98,11 @@ apr_status_t h2_conn_child_init(apr_pool_t *pool, server_rec *s)
             maxw = minw;
         }
     }
-    workers = h2_workers_create(s, pool, minw, maxw);
+    workers = h2_workers_create(s, pool, minw, maxw, 
+                                stack_size, max_mem_free);
     h2_workers_set_max_idle_secs(
         workers, h2_config_geti(config, H2_CONF_MAX_WORKER_IDLE_SECS));
+    h2_workers_log_stats(workers);
     return status;
 }
 
@@ -283,9 +293,62 @@ apr_status_t h2_session_process(h2_session *session)
     return DONE;
 }
 
+static int may_run_inline(h2_session *session, h2_stream *stream)
+{
+    if (!session->inline_locations || !stream->request->path
+        || (stream->state != H2_STREAM_ST_CLOSED_INPUT
+            && stream->state != H2_STREAM_ST_CLOSED)) {
+        /* a task still reading its body would block us */
+        return 0;
+    }
+    
+    int found = h2_util_in_locations(session->inline_locations, 
+                                     stream->request->path);
+    /* Requests without body are cheaper to run than to hand over. With
+     * a body, only skip the line when workers are busy. */
+    return found && (h2_request_get_content_length(stream->request) <= 0
+                     || h2_workers_has_backlog(workers));
+}
+
+/* Process the task on the session thread, return 0 if that is not
+ * possible and it needs to be scheduled. */
+static int run_inline(h2_session *session, h2_stream *stream, h2_task *task)
+{
+    if (!session->inline_worker) {
+        h2_config *config = h2_config_get(session->c);
+        apr_size_t max_mem_free = 1024 * (apr_size_t)h2_config_geti(config,
+                                              H2_CONF_SESSION_MAX_MEM_FREE);
+        session->inline_worker = h2_worker_create_inline(0, session->pool, 
+                                               session->c->current_thread,
+                                               max_mem_free);
+        if (!session->inline_worker) {
+            return 0;
+        }
+    }
+    
+    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c,
+                  "h2_session(%ld): running task(%s) inline",
+                  session->id, h2_task_get_id(task));
+    /* let close find the task done, as with our workers */
+    h2_task_set_started(task, 1);
+    apr_status_t status = h2_task_do(task, session->inline_worker);
+    h2_task_set_finished(task, 1);
+    h2_mplx_task_done(session->mplx, stream->id);
+    ++session->inline_count;
+    if (status != APR_SUCCESS) {
+        ap_log_cerror(APLOG_MARK, APLOG_WARNING, status, session->c,
+                      "h2_session(%ld): inline task(%s)",
+                      session->id, h2_task_get_id(task));
+    }
+    return 1;
+}
+
 static void after_stream_opened_cb(h2_session *session,
                                 h2_stream *stream, h2_task *task)
 {
+    if (may_run_inline(session, stream) && run_inline(session, stream, task)) {
+        return;
+    }
     apr_status_t status = h2_workers_schedule(workers, task);
     if (status != APR_SUCCESS) {
         ap_log_cerror(APLOG_MARK, APLOG_ERR, status, session->c,
@@ -379,9 +442,10 @@ apr_status_t h2_conn_prep(h2_conn *conn, h2_worker *worker)
      * sub-resources from it, so that we get a nice reuse of
      * pools.
      */
-    apr_pool_t *worker_pool = h2_worker_get_pool(worker);
-    
-    apr_pool_create(&conn->pool, worker_pool);
+    apr_status_t status = h2_worker_get_conn_pool(worker, &conn->pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
     conn->bucket_alloc = h2_worker_get_bucket_alloc(worker);
     conn->socket = h2_worker_get_socket(worker);
     
@@ -482,8 +546,11 @@ apr_status_t h2_conn_post(h2_conn *conn, h2_worker *worker)
      */
     conn->socket = NULL;
     conn->bucket_alloc = NULL;
-    apr_pool_destroy(conn->pool);
-    conn->pool = NULL;
+    if (conn->pool) {
+        /* cleared, the next task on this worker reuses it */
+        h2_worker_put_conn_pool(worker, conn->pool);
+        conn->pool = NULL;
+    }
     /* be sure no one messes with this any more */
     memset(conn->c, 0, sizeof(conn_rec)); 
     
@@ -0,0 +1,424 @@
+/* Copyright 2015 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_file_io.h>
+#include <apr_thread_cond.h>
+#include <apr_thread_mutex.h>
+
+#include <httpd.h>
+#include <http_core.h>
+#include <http_log.h>
+
+#include "h2_private.h"
+#include "h2_flight.h"
+#include "h2_mplx.h"
+#include "h2_request.h"
+#include "h2_response.h"
+#include "h2_util.h"
+
+typedef struct h2_follower h2_follower;
+
+struct h2_follower {
+    h2_follower *next;
+    struct h2_mplx *m;
+    int stream_id;
+    int dropped;                /* output failed, leaves at end of copy */
+    apr_file_t *spool;          /* output the follower's client is slow on */
+    apr_file_t *spool_in;       /* read handle, until the h2_mplx has it */
+    apr_off_t spool_len;        /* bytes written to the spool */
+};
+
+struct h2_flight {
+    char *key;                  /* scheme, authority, path, variants */
+    int refs;                   /* the leader's and those of followers */
+    int boarding;               /* no output yet, identical requests join */
+    int busy;                   /* leader copies, followers stay listed */
+    int private;                /* response not to be shared */
+    h2_follower *followers;
+};
+
+typedef struct {
+    apr_thread_mutex_t *lock;
+    apr_thread_cond_t *idle;    /* signalled when a flight is no longer busy */
+    apr_hash_t *boarding;       /* key -> h2_flight*, while boarding */
+} h2_flights;
+
+/* There is one registry per child, set up before any connection is
+ * served. Flights live across sessions and are malloc'ed. */
+static h2_flights *flights;
+
+static void flight_unref(h2_flight *flight)
+{
+    if (--flight->refs == 0) {
+        free(flight);
+    }
+}
+
+/* Call with the lock held. */
+static void flight_close_boarding(h2_flight *flight)
+{
+    if (flight->boarding) {
+        apr_hash_set(flights->boarding, flight->key, APR_HASH_KEY_STRING, 
+                     NULL);
+        flight->boarding = 0;
+    }
+}
+
+static apr_status_t flights_cleanup(void *data)
+{
+    flights = NULL;
+    return APR_SUCCESS;
+}
+
+apr_status_t h2_flight_child_init(apr_pool_t *pool, server_rec *s)
+{
+    h2_flights *fl = apr_pcalloc(pool, sizeof(h2_flights));
+    apr_status_t status = apr_thread_mutex_create(&fl->lock,
+                                                  APR_THREAD_MUTEX_DEFAULT,
+                                                  pool);
+    if (status == APR_SUCCESS) {
+        status = apr_thread_cond_create(&fl->idle, pool);
+    }
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    fl->boarding = apr_hash_make(pool);
+    flights = fl;
+    apr_pool_cleanup_register(pool, fl, flights_cleanup, 
+                              apr_pool_cleanup_null);
+    return APR_SUCCESS;
+}
+
+static int may_collapse(h2_request *req)
+{
+    /* Requests with credentials, ranges or asking to be revalidated
+     * are not answered from someone else's response. */
+    return (flights && req->method && !strcmp("GET", req->method)
+            && req->authority && req->path
+            && !h2_request_get_cache_bypass(req));
+}
+
+h2_flight *h2_flight_join(h2_request *req, h2_mplx *m, int stream_id, 
+                          int *pleader)
+{
+    if (!may_collapse(req)) {
+        return NULL;
+    }
+
+    const char *variant = h2_request_get_variant(req);
+    const char *inm = h2_request_get_if_none_match(req);
+    const char *key = apr_pstrcat(req->pool, 
+                                  req->scheme? req->scheme : "http", "://",
+                                  req->authority, req->path, 
+                                  "\n", variant? variant : "", 
+                                  "If-None-Match: ", inm? inm : "", NULL);
+    h2_flight *flight = NULL;
+    apr_status_t status = apr_thread_mutex_lock(flights->lock);
+    if (APR_SUCCESS == status) {
+        flight = apr_hash_get(flights->boarding, key, APR_HASH_KEY_STRING);
+        if (flight) {
+            h2_follower *follower = calloc(1, sizeof(h2_follower));
+            if (follower) {
+                follower->m = m;
+                follower->stream_id = stream_id;
+                follower->next = flight->followers;
+                flight->followers = follower;
+                ++flight->refs;
+                *pleader = 0;
+            }
+            else {
+                flight = NULL;
+            }
+        }
+        else {
+            apr_size_t klen = strlen(key);
+            flight = calloc(1, sizeof(h2_flight) + klen + 1);
+            if (flight) {
+                flight->key = (char *)(flight + 1);
+                memcpy(flight->key, key, klen + 1);
+                flight->refs = 1;
+                flight->boarding = 1;
+                apr_hash_set(flights->boarding, flight->key, 
+                             APR_HASH_KEY_STRING, flight);
+                *pleader = 1;
+            }
+        }
+        apr_thread_mutex_unlock(flights->lock);
+    }
+    return flight;
+}
+
+void h2_flight_leave(h2_flight *flight, h2_mplx *m, int stream_id)
+{
+    apr_status_t status = apr_thread_mutex_lock(flights->lock);
+    if (APR_SUCCESS == status) {
+        /* the leader may be writing to our stream outside the lock */
+        while (flight->busy) {
+            apr_thread_cond_wait(flights->idle, flights->lock);
+        }
+        for (h2_follower **pf = &flight->followers; *pf; pf = &(*pf)->next) {
+            h2_follower *follower = *pf;
+            if (follower->m == m && follower->stream_id == stream_id) {
+                *pf = follower->next;
+                free(follower);
+                break;
+            }
+        }
+        flight_unref(flight);
+        apr_thread_mutex_unlock(flights->lock);
+    }
+}
+
+/* Copy the buckets, giving the follower its own copy of each. Data
+ * is copied into malloc'ed heap buckets and files are opened again,
+ * so the follower's h2_mplx may take them over as it does with a
+ * task's output. Buckets that cannot be copied this way, e.g. those of 
+ * a pipe, are read into memory first. Metadata other than EOS and 
+ * FLUSH stays with the leader. */
+static apr_status_t copy_brigade(apr_bucket_brigade *to, 
+                                 apr_bucket_brigade *from)
+{
+    for (apr_bucket *b = APR_BRIGADE_FIRST(from);
+         b != APR_BRIGADE_SENTINEL(from);
+         b = APR_BUCKET_NEXT(b)) {
+        
+        if (APR_BUCKET_IS_METADATA(b)) {
+            if (APR_BUCKET_IS_EOS(b)) {
+                APR_BRIGADE_INSERT_TAIL(to, 
+                    apr_bucket_eos_create(to->bucket_alloc));
+            }
+            else if (APR_BUCKET_IS_FLUSH(b)) {
+                APR_BRIGADE_INSERT_TAIL(to, 
+                    apr_bucket_flush_create(to->bucket_alloc));
+            }
+            continue;
+        }
+        
+        if (APR_BUCKET_IS_FILE(b)) {
+            apr_bucket_file *f = (apr_bucket_file *)b->data;
+            const char *fname = NULL;
+            apr_file_t *fd = NULL;
+            if (apr_file_name_get(&fname, f->fd) == APR_SUCCESS && fname
+                && apr_file_open(&fd, fname, APR_FOPEN_READ|APR_FOPEN_BINARY,
+                                 APR_OS_DEFAULT, to->p) == APR_SUCCESS) {
+                APR_BRIGADE_INSERT_TAIL(to, 
+                    apr_bucket_file_create(fd, b->start, b->length, 
+                                           to->p, to->bucket_alloc));
+                continue;
+            }
+        }
+        
+        const char *data;
+        apr_size_t len;
+        apr_status_t status = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        if (len > 0) {
+            char *copy = malloc(len);
+            if (!copy) {
+                return APR_ENOMEM;
+            }
+            memcpy(copy, data, len);
+            APR_BRIGADE_INSERT_TAIL(to, 
+                apr_bucket_heap_create(copy, len, free, to->bucket_alloc));
+        }
+    }
+    return APR_SUCCESS;
+}
+
+/* Spool the data at the head of the brigade for a follower whose
+ * client is slower than the leader, as a task does for its own. The
+ * spool lives in the pool of the leader's connection, the follower's
+ * h2_io takes over the handle to read it. */
+static apr_status_t follower_spool(h2_follower *follower, ap_filter_t *f,
+                                   apr_bucket_brigade *bb)
+{
+    apr_status_t status = APR_SUCCESS;
+    if (!follower->spool) {
+        status = h2_util_spool_create(&follower->spool, &follower->spool_in,
+                                      f->c->pool);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+    }
+    
+    apr_off_t len = 0;
+    status = h2_util_spool_write(follower->spool, bb, 0, &len);
+    if (len > 0) {
+        apr_status_t qstatus = h2_mplx_out_spooled(follower->m, 
+                                                   follower->stream_id,
+                                                   &follower->spool_in,
+                                                   follower->spool_len, len);
+        follower->spool_len += len;
+        if (status == APR_SUCCESS) {
+            status = qstatus;
+        }
+    }
+    return status;
+}
+
+/* Call with the lock held. Followers without a response are reset. */
+static void close_followers(h2_flight *flight)
+{
+    while (flight->followers) {
+        h2_follower *follower = flight->followers;
+        flight->followers = follower->next;
+        h2_mplx_out_close(follower->m, follower->stream_id);
+        free(follower);
+    }
+}
+
+void h2_flight_private(h2_flight *flight)
+{
+    apr_status_t status = apr_thread_mutex_lock(flights->lock);
+    if (APR_SUCCESS == status) {
+        flight_close_boarding(flight);
+        flight->private = 1;
+        apr_thread_mutex_unlock(flights->lock);
+    }
+}
+
+/* The request headers followers agree on with the leader, next to
+ * authority and path, see h2_to_h1. */
+static const char *const key_headers[] = {
+    "Accept", "Accept-Encoding", "Accept-Language", "Cookie", NULL
+};
+
+/* Returns != 0 iff the response depends on request headers that are 
+ * not part of the flight key, so followers may have asked for another
+ * variant. */
+static int varies_beyond_key(apr_pool_t *pool, h2_response *response)
+{
+    const char *vary = apr_table_get(response->headers, "Vary");
+    if (!vary) {
+        return 0;
+    }
+    char *last = NULL;
+    for (char *tok = apr_strtok(apr_pstrdup(pool, vary), ",", &last); tok;
+         tok = apr_strtok(NULL, ",", &last)) {
+        while (*tok == ' ' || *tok == '\t') {
+            ++tok;
+        }
+        apr_size_t tlen = strlen(tok);
+        while (tlen > 0 && (tok[tlen-1] == ' ' || tok[tlen-1] == '\t')) {
+            tok[--tlen] = '\0';
+        }
+        if (!tlen) {
+            continue;
+        }
+        int in_key = 0;
+        for (const char *const *h = key_headers; *h && !in_key; ++h) {
+            in_key = !apr_strnatcasecmp(tok, *h);
+        }
+        if (!in_key) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+apr_status_t h2_flight_out(h2_flight *flight, h2_response *response,
+                           ap_filter_t *f, apr_bucket_brigade *bb)
+{
+    int vary = (response && varies_beyond_key(bb->p, response));
+    apr_status_t status = apr_thread_mutex_lock(flights->lock);
+    if (APR_SUCCESS != status) {
+        return status;
+    }
+    flight_close_boarding(flight);
+    if (vary) {
+        /* e.g. "Vary: Origin", the response is not ours to share */
+        flight->private = 1;
+    }
+    if (flight->private) {
+        close_followers(flight);
+    }
+    if (!flight->followers) {
+        apr_thread_mutex_unlock(flights->lock);
+        return APR_SUCCESS;
+    }
+    /* Boarding is closed and followers wait for us to leave, so the
+     * list stays as it is while we copy without holding the lock. The
+     * followers' h2_mplx never have us wait for their clients. */
+    flight->busy = 1;
+    apr_thread_mutex_unlock(flights->lock);
+    
+    apr_bucket_brigade *tmp = apr_brigade_create(bb->p, bb->bucket_alloc);
+    for (h2_follower *follower = flight->followers; 
+         follower && status == APR_SUCCESS; 
+         follower = follower->next) {
+        status = copy_brigade(tmp, bb);
+        if (status == APR_SUCCESS) {
+            apr_status_t fstatus = h2_mplx_out_follow(follower->m, 
+                                                      follower->stream_id,
+                                                      response, f, tmp);
+            while (fstatus == APR_INCOMPLETE) {
+                /* the follower's client is slow, spool what does not 
+                 * fit into its memory */
+                fstatus = follower_spool(follower, f, tmp);
+                if (fstatus == APR_SUCCESS) {
+                    fstatus = h2_mplx_out_follow(follower->m, 
+                                                 follower->stream_id,
+                                                 NULL, f, tmp);
+                }
+            }
+            if (fstatus != APR_SUCCESS) {
+                /* follower's stream or connection is gone or could not
+                 * keep up, stop serving it. */
+                ap_log_cerror(APLOG_MARK, APLOG_DEBUG, fstatus, f->c,
+                              "h2_flight(%ld-%d): follower dropped",
+                              h2_mplx_get_id(follower->m), 
+                              follower->stream_id);
+                follower->dropped = 1;
+            }
+        }
+        apr_brigade_cleanup(tmp);
+    }
+    apr_brigade_destroy(tmp);
+    
+    apr_thread_mutex_lock(flights->lock);
+    h2_follower **pf = &flight->followers;
+    while (*pf) {
+        h2_follower *follower = *pf;
+        if (follower->dropped) {
+            *pf = follower->next;
+            free(follower);
+        }
+        else {
+            pf = &follower->next;
+        }
+    }
+    flight->busy = 0;
+    apr_thread_cond_broadcast(flights->idle);
+    apr_thread_mutex_unlock(flights->lock);
+    return status;
+}
+
+void h2_flight_end(h2_flight *flight)
+{
+    apr_status_t status = apr_thread_mutex_lock(flights->lock);
+    if (APR_SUCCESS == status) {
+        flight_close_boarding(flight);
+        close_followers(flight);
+        flight_unref(flight);
+        apr_thread_mutex_unlock(flights->lock);
+    }
+}
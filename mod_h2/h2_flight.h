@@ -0,0 +1,95 @@
+/* Copyright 2015 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __mod_h2__h2_flight__
+#define __mod_h2__h2_flight__
+
+/**
+ * Collapsing of identical GET requests, shared by all sessions of a
+ * child process. The first request for a resource becomes the leader of
+ * a flight and gets a h2_task as usual. Identical requests arriving
+ * before the leader's task has produced its response headers follow
+ * it: they get no task of their own, instead the leader's task copies
+ * its response and body into the h2_mplx of each follower.
+ *
+ * Followers see exactly what the leader's task produces, each in a
+ * copy of its own. A follower's output never makes the task wait: it
+ * is held within the follower's output budget and what exceeds that is
+ * spooled, as a task spools its own output, also when tasks do not 
+ * spool. A follower whose client falls behind by more than a configured
+ * H2StreamMaxSpoolSize is reset. Files are not held in memory.
+ *
+ * Connections with a TLS client certificate do not take part, nor do 
+ * requests that were authenticated, see h2_flight_private().
+ */
+struct h2_mplx;
+struct h2_request;
+struct h2_response;
+
+typedef struct h2_flight h2_flight;
+
+/**
+ * Set up the flight registry of the child process.
+ */
+apr_status_t h2_flight_child_init(apr_pool_t *pool, server_rec *s);
+
+/**
+ * Take part in the flight for the request. When no flight for an
+ * identical request is boarding, a new one is started with the stream
+ * as leader, which then needs to run a task. Otherwise the stream
+ * follows and will have its output written by the leader's task.
+ * @param req the complete request, without body
+ * @param m the multiplexer of the stream
+ * @param stream_id the stream of the request
+ * @param pleader on return, != 0 iff the stream leads the flight
+ * @return the flight or NULL if the request may not be collapsed
+ */
+h2_flight *h2_flight_join(struct h2_request *req, struct h2_mplx *m, 
+                          int stream_id, int *pleader);
+
+/**
+ * A follower leaves the flight, e.g. because its stream has been reset.
+ * Must be called before the follower's h2_io is closed.
+ */
+void h2_flight_leave(h2_flight *flight, struct h2_mplx *m, int stream_id);
+
+/**
+ * The leader's response depends on who asked, e.g. its request has
+ * been authenticated. Closes the flight for boarding, followers
+ * present are reset when the response is written.
+ */
+void h2_flight_private(h2_flight *flight);
+
+/**
+ * Copy the output of the leader's task to all followers. This closes
+ * the flight for boarding. A response with a Vary on request headers
+ * other than the ones followers agree on is not shared, followers are
+ * reset as with h2_flight_private().
+ * @param flight the flight led by the task
+ * @param response the response on the first call, NULL afterwards
+ * @param f the filter the output was written to
+ * @param bb the output, left untouched
+ */
+apr_status_t h2_flight_out(h2_flight *flight, struct h2_response *response,
+                           ap_filter_t *f, apr_bucket_brigade *bb);
+
+/**
+ * The leader is done, close the output of all followers and give up
+ * the leader's reference. Followers that did not get a response are
+ * reset.
+ */
+void h2_flight_end(h2_flight *flight);
+
+#endif /* defined(__mod_h2__h2_flight__) */
@@ -25,6 +25,7 @@
 
 #include "h2_private.h"
 #include "h2_bucket.h"
+#include "h2_config.h"
 #include "h2_response.h"
 #include "h2_from_h1.h"
 #include "h2_task.h"
@@ -100,6 +101,8 @@ static apr_status_t make_h2_headers(h2_from_h1 *from_h1, request_rec *r)
                       from_h1->stream_id);
         return APR_EINVAL;
     }
+    h2_response_never_index(from_h1->response, 
+                            h2_config_rget(r)->hpack_never_index);
     from_h1->content_length = from_h1->response->content_length;
     from_h1->chunked = r->chunked;
     
@@ -33,6 +33,7 @@
 #include "h2_config.h"
 #include "h2_ctx.h"
 #include "h2_conn.h"
+#include "h2_flight.h"
 #include "h2_h2.h"
 
 const char *h2_protos[] = {
@@ -74,6 +75,7 @@ APR_DECLARE_OPTIONAL_FN(int, modssl_register_alpn,
                          ssl_alpn_proto_negotiated negotiatedfn));
 
 int h2_h2_post_read_req(request_rec *r);
+int h2_h2_fixups(request_rec *r);
 
 static int (*opt_ssl_engine_disable)(conn_rec*);
 static int (*opt_ssl_is_https)(conn_rec*);
@@ -125,6 +127,11 @@ void h2_h2_register_hooks(void)
     ap_hook_process_connection(h2_h2_process_conn, NULL, NULL, APR_HOOK_FIRST);
     
     ap_hook_post_read_request(h2_h2_post_read_req, NULL, NULL, APR_HOOK_MIDDLE);
+    
+    /* Once authentication has run, we know if the response of a 
+     * request leading a flight may be shared with its followers.
+     */
+    ap_hook_fixups(h2_h2_fixups, NULL, NULL, APR_HOOK_LAST);
 }
 
 apr_status_t h2_h2_init(apr_pool_t *pool, server_rec *s)
@@ -157,6 +164,16 @@ int h2_h2_is_tls(conn_rec *c)
     return opt_ssl_is_https && opt_ssl_is_https(c);
 }
 
+int h2_h2_has_client_cert(conn_rec *c)
+{
+    if (!h2_h2_is_tls(c) || !opt_ssl_var_lookup) {
+        return 0;
+    }
+    const char *verify = opt_ssl_var_lookup(c->pool, c->base_server, c, 
+                                            NULL, "SSL_CLIENT_VERIFY");
+    return verify && *verify && strcmp("NONE", verify);
+}
+
 
 static int h2_util_array_index(apr_array_header_t *array, const char *s)
 {
@@ -396,6 +413,24 @@ int h2_h2_post_read_req(request_rec *r)
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r,
                       "adding h1_to_h2_resp output filter");
         ap_add_output_filter("H1_TO_H2_RESP", task, r, r->connection);
+        if (task->expect_continue) {
+            /* The Expect header was kept from httpd, we send the
+             * 100 as HEADERS frame when the body is asked for. */
+            ap_add_input_filter("H2_CONTINUE", task, r, r->connection);
+        }
+    }
+    return DECLINED;
+}
+
+int h2_h2_fixups(request_rec *r)
+{
+    h2_ctx *ctx = h2_ctx_rget(r, 0);
+    struct h2_task *task = ctx? h2_ctx_get_task(ctx) : NULL;
+    if (task && task->flight && (r->user || r->ap_auth_type)) {
+        /* whoever follows has not shown the same credentials */
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r,
+                      "h2_h2, authenticated response not shared");
+        h2_flight_private(task->flight);
     }
     return DECLINED;
 }
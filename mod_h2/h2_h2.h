@@ -45,6 +45,10 @@ int h2_h2_stream_pre_conn(conn_rec* c, void *arg);
  */
 int h2_h2_is_tls(conn_rec *c);
 
+/* Did the client present a certificate on the TLS connection?
+ */
+int h2_h2_has_client_cert(conn_rec *c);
+
 /* Register apache hooks for h2 protocol
  */
 void h2_h2_register_hooks(void);
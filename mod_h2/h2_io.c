@@ -15,6 +15,9 @@
 
 #include <assert.h>
 
+#include <apr_file_io.h>
+#include <apr_strings.h>
+
 #include <httpd.h>
 #include <http_core.h>
 #include <http_log.h>
@@ -32,6 +35,7 @@ h2_io *h2_io_create(int id, apr_pool_t *pool, apr_bucket_alloc_t *bucket_alloc)
     h2_io *io = apr_pcalloc(pool, sizeof(*io));
     if (io) {
         io->id = id;
+        io->pool = pool;
         h2_bucket_queue_init(&io->input);
         io->bbout = apr_brigade_create(pool, bucket_alloc);
     }
@@ -48,9 +52,16 @@ void h2_io_cleanup(h2_io *io)
 }
 
 void h2_io_destroy(h2_io *io)
+{
+    /* io itself lives in its pool */
+    apr_pool_destroy(h2_io_release(io));
+}
+
+apr_pool_t *h2_io_release(h2_io *io)
 {
     h2_io_cleanup(io);
     apr_brigade_destroy(io->bbout);
+    return io->pool;
 }
 
 int h2_io_in_has_eos_for(h2_io *io)
@@ -63,20 +74,21 @@ int h2_io_out_has_data(h2_io *io)
     return !APR_BRIGADE_EMPTY(io->bbout);
 }
 
-apr_size_t h2_io_out_length(h2_io *io)
+apr_off_t h2_io_out_length(h2_io *io)
 {
-    if (io->bbout) {
-        apr_off_t len = 0;
-        apr_brigade_length(io->bbout, 0, &len);
-        return (len > 0)? len : 0;
-    }
-    return 0;
+    return io->out_queued;
+}
+
+apr_off_t h2_io_out_mem(h2_io *io)
+{
+    return io->out_queued - io->out_files;
 }
 
 apr_status_t h2_io_in_read(h2_io *io, struct h2_bucket **pbucket)
 {
     apr_status_t status = h2_bucket_queue_pop(&io->input, pbucket);
     if (status == APR_SUCCESS) {
+        io->input_queued -= (*pbucket)->data_len;
         io->input_consumed += (*pbucket)->data_len;
     }
     return status;
@@ -84,7 +96,12 @@ apr_status_t h2_io_in_read(h2_io *io, struct h2_bucket **pbucket)
 
 apr_status_t h2_io_in_write(h2_io *io, struct h2_bucket *bucket)
 {
-    return h2_bucket_queue_append(&io->input, bucket);
+    apr_size_t len = bucket->data_len;
+    apr_status_t status = h2_bucket_queue_append(&io->input, bucket);
+    if (status == APR_SUCCESS) {
+        io->input_queued += len;
+    }
+    return status;
 }
 
 apr_status_t h2_io_in_close(h2_io *io)
@@ -98,18 +115,98 @@ h2_response *h2_io_extract_response(h2_io *io)
 }
 
 
+/* Bytes in the FILE buckets that follow b in bb. */
+static apr_off_t file_len_after(apr_bucket_brigade *bb, apr_bucket *b)
+{
+    apr_off_t len = 0;
+    for (b = APR_BUCKET_NEXT(b); b != APR_BRIGADE_SENTINEL(bb); 
+         b = APR_BUCKET_NEXT(b)) {
+        if (APR_BUCKET_IS_FILE(b)) {
+            len += b->length;
+        }
+    }
+    return len;
+}
+
 apr_status_t h2_io_out_read(h2_io *io, apr_bucket_brigade *bb, 
-                            apr_size_t maxlen)
+                            apr_size_t maxlen, apr_off_t *pmoved)
 {
-    return h2_util_move(bb, io->bbout, maxlen, "h2_io_out_read");
+    apr_off_t moved = 0;
+    apr_bucket *last = APR_BRIGADE_LAST(bb);
+    /* Our FILE buckets share their file with no other bucket. They all
+     * leave as FILE buckets, the ones appended to bb are what we lost. */
+    apr_status_t status = h2_util_move(bb, io->bbout, maxlen, io->pool,
+                                       &moved, "h2_io_out_read");
+    apr_off_t files = file_len_after(bb, last);
+    io->out_queued -= moved;
+    io->out_files -= files;
+    /* A file leaves as a whole and is sent long after, only the memory 
+     * bytes tell how fast the client reads. */
+    io->out_drained += moved - files;
+    if (pmoved) {
+        *pmoved = moved;
+    }
+    return status;
 }
 
 apr_status_t h2_io_out_write(h2_io *io, apr_bucket_brigade *bb, 
                              apr_size_t maxlen)
 {
-    return h2_util_move(io->bbout, bb, maxlen, "h2_io_out_write");
+    apr_off_t moved = 0;
+    apr_bucket *last = APR_BRIGADE_LAST(io->bbout);
+    apr_status_t status = h2_util_move(io->bbout, bb, maxlen, io->pool, 
+                                       &moved, "h2_io_out_write");
+    io->out_queued += moved;
+    io->out_files += file_len_after(io->bbout, last);
+    return status;
 }
 
+apr_status_t h2_io_out_meta(h2_io *io, apr_bucket_brigade *bb)
+{
+    while (!APR_BRIGADE_EMPTY(bb)) {
+        apr_bucket *b = APR_BRIGADE_FIRST(bb);
+        if (!APR_BUCKET_IS_METADATA(b)) {
+            break;
+        }
+        if (APR_BUCKET_IS_EOS(b)) {
+            APR_BRIGADE_INSERT_TAIL(io->bbout, 
+                apr_bucket_eos_create(io->bbout->bucket_alloc));
+        }
+        else if (APR_BUCKET_IS_FLUSH(b)) {
+            APR_BRIGADE_INSERT_TAIL(io->bbout, 
+                apr_bucket_flush_create(io->bbout->bucket_alloc));
+        }
+        apr_bucket_delete(b);
+    }
+    return APR_SUCCESS;
+}
+
+apr_status_t h2_io_out_spooled(h2_io *io, apr_file_t **pspool_in,
+                               apr_off_t start, apr_off_t len)
+{
+    if (!io->spool_in) {
+        if (!*pspool_in) {
+            return APR_EINVAL;
+        }
+        apr_status_t status = apr_file_setaside(&io->spool_in, *pspool_in, 
+                                                io->pool);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        *pspool_in = NULL;
+    }
+    
+    apr_bucket *b = apr_bucket_file_create(io->spool_in, start, 
+                                           (apr_size_t)len, io->pool, 
+                                           io->bbout->bucket_alloc);
+    /* the file keeps growing, do not map it */
+    apr_bucket_file_enable_mmap(b, 0);
+    APR_BRIGADE_INSERT_TAIL(io->bbout, b);
+    io->spool_len += len;
+    io->out_queued += len;
+    io->out_files += len;
+    return APR_SUCCESS;
+}
 
 apr_status_t h2_io_out_close(h2_io *io)
 {
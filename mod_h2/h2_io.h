@@ -26,13 +26,25 @@ struct h2_task;
 typedef struct h2_io h2_io;
 struct h2_io {
     int id;                      /* stream identifier */
+    apr_pool_t *pool;            /* holds io, response and output brigade */
     
     h2_bucket_queue input;       /* input data for stream */
+    apr_size_t input_queued;     /* how many bytes wait to be read */
     apr_size_t input_consumed;   /* how many bytes have been read */
     struct apr_thread_cond_t *input_arrived; /* block on reading */
+    int window_held;             /* no window updates before the 100 */
     
     apr_bucket_brigade *bbout;   /* output data from stream */
+    apr_off_t out_queued;        /* data bytes in bbout */
+    apr_off_t out_files;         /* of those, bytes in FILE buckets */
     struct apr_thread_cond_t *output_drained; /* block on writing */
+    apr_file_t *spool_in;        /* the task's spool as read by the session */
+    apr_off_t spool_len;         /* bytes the task spooled */
+    apr_time_t out_started;      /* when the task wrote its first output */
+    apr_off_t out_drained;       /* memory bytes taken by the session */
+    apr_off_t out_rate;          /* bytes/s the session took lately */
+    apr_time_t out_rate_since;   /* start of the current rate sample */
+    apr_off_t out_rate_drained;  /* out_drained at that start */
     
     struct h2_task *task;         /* the task connected to this io */
     struct h2_response *response; /* submittable response created */
@@ -43,15 +55,24 @@ struct h2_io {
  ******************************************************************************/
 
 /**
- * Creates a new h2_io for the given stream id. 
+ * Creates a new h2_io for the given stream id in the given pool. The
+ * pool is owned by the io from then on.
  */
 h2_io *h2_io_create(int id, apr_pool_t *pool, apr_bucket_alloc_t *bucket_alloc);
 
 /**
- * Frees any resources hold by the h2_io instance. 
+ * Frees any resources hold by the h2_io instance, including its pool
+ * and the io itself. 
  */
 void h2_io_destroy(h2_io *io);
 
+/**
+ * Frees the resources of the h2_io instance, but not its pool, which
+ * is returned for reuse. The io itself is gone with the pool's next
+ * clear.
+ */
+apr_pool_t *h2_io_release(h2_io *io);
+
 /**
  * The input data is completely queued. Blocked reads will return immediately
  * and give either data or EOF.
@@ -92,13 +113,28 @@ struct h2_response *h2_io_extract_response(h2_io *io);
  * Read a bucket from the output head. Return APR_EAGAIN if non is available,
  * APR_EOF if none available and output has been closed. Will, on successful
  * read, set peos != 0 if data is the last data of the output.
+ * @param pmoved on return, the number of data bytes added to bb, may be NULL
  */
 apr_status_t h2_io_out_read(h2_io *io, apr_bucket_brigade *bb, 
-                            apr_size_t maxlen);
+                            apr_size_t maxlen, apr_off_t *pmoved);
 
 apr_status_t h2_io_out_write(h2_io *io, apr_bucket_brigade *bb, 
                              apr_size_t maxlen);
 
+/**
+ * Queue the EOS and FLUSH buckets at the head of the brigade, which take
+ * no memory. Other metadata is dropped.
+ */
+apr_status_t h2_io_out_meta(h2_io *io, apr_bucket_brigade *bb);
+
+/**
+ * Queues len bytes a writer has appended to its spool file at start
+ * for output, as a FILE bucket. On the first call, the io takes over 
+ * the handle to read the spool with and sets *pspool_in to NULL.
+ */
+apr_status_t h2_io_out_spooled(h2_io *io, apr_file_t **pspool_in,
+                               apr_off_t start, apr_off_t len);
+
 /**
  * Closes the input. After existing data has been read, APR_EOF will
  * be returned.
@@ -106,10 +142,16 @@ apr_status_t h2_io_out_write(h2_io *io, apr_bucket_brigade *bb,
 apr_status_t h2_io_out_close(h2_io *io);
 
 /**
- * Gives the overall length of the data that is currently queued for
- * output.
+ * Gives the length of the data that is currently queued for output,
+ * including data in files. Kept as a running count, no brigade scan.
+ */
+apr_off_t h2_io_out_length(h2_io *io);
+
+/**
+ * Gives the length of the queued output that is held in memory, that
+ * is without data in files.
  */
-apr_size_t h2_io_out_length(h2_io *io);
+apr_off_t h2_io_out_mem(h2_io *io);
 
 
 #endif /* defined(__mod_h2__h2_io__) */
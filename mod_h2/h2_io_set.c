@@ -29,6 +29,10 @@
 
 #define h2_io_IDX(list, i) ((h2_io**)(list)->elts)[i]
 
+/* Every connection has several of these, most of them mostly empty. The
+ * array grows when more streams are open. */
+#define H2_SET_INIT_SIZE    16
+
 struct h2_io_set {
     apr_array_header_t *list;
 };
@@ -37,7 +41,7 @@ h2_io_set *h2_io_set_create(apr_pool_t *pool)
 {
     h2_io_set *sp = apr_pcalloc(pool, sizeof(h2_io_set));
     if (sp) {
-        sp->list = apr_array_make(pool, 100, sizeof(h2_io*));
+        sp->list = apr_array_make(pool, H2_SET_INIT_SIZE, sizeof(h2_io*));
         if (!sp->list) {
             return NULL;
         }
@@ -162,6 +166,19 @@ void h2_io_set_iter(h2_io_set *sp,
     }
 }
 
+void h2_io_set_filter(h2_io_set *sp, h2_io_set_iter_fn *keep, void *ctx)
+{
+    /* ids stay sorted when we close the gaps in order */
+    int n = 0;
+    for (int i = 0; i < sp->list->nelts; ++i) {
+        h2_io *io = h2_io_IDX(sp->list, i);
+        if (keep(ctx, io)) {
+            h2_io_IDX(sp->list, n++) = io;
+        }
+    }
+    sp->list->nelts = n;
+}
+
 apr_size_t h2_io_set_size(h2_io_set *sp)
 {
     return sp->list->nelts;
@@ -44,4 +44,10 @@ typedef int h2_io_set_iter_fn(void *ctx, struct h2_io *io);
 void h2_io_set_iter(h2_io_set *set,
                            h2_io_set_iter_fn *iter, void *ctx);
 
+/**
+ * Call the function for all ios in the set and keep only those for
+ * which it returns != 0.
+ */
+void h2_io_set_filter(h2_io_set *set, h2_io_set_iter_fn *keep, void *ctx);
+
 #endif /* defined(__mod_h2__h2_io_set__) */
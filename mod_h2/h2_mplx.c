@@ -35,6 +35,10 @@
 #include "h2_task.h"
 #include "h2_task_input.h"
 #include "h2_task_output.h"
+#include "h2_util.h"
+
+/* Cleared io pools kept for the next streams. */
+#define H2_SPARE_IO_POOLS       8
 
 struct h2_mplx {
     long id;
@@ -44,7 +48,12 @@ struct h2_mplx {
     
     h2_io_set *stream_ios;
     h2_io_set *ready_ios;
+    h2_io_set *continue_ios;
+    h2_io_set *stalled_ios;
+    h2_io_set *consumed_ios;    /* had input read since last update */
+    h2_io_set *data_ios;        /* got output since the session looked */
     h2_io_set *task_finished_ios;
+    h2_pool_cache io_pools;     /* cleared pools for new ios */
     
     apr_thread_mutex_t *lock;
     apr_thread_cond_t *added_output;
@@ -52,6 +61,16 @@ struct h2_mplx {
     int aborted;
     
     apr_size_t out_stream_max_size;
+    apr_off_t out_session_max_size;
+    apr_off_t out_queued;       /* output in memory, over all ios */
+    apr_off_t out_stream_max_spool;
+    apr_interval_time_t out_stream_timeout;
+    apr_off_t out_stream_min_rate;
+    apr_interval_time_t in_stream_timeout;
+    
+    apr_size_t in_queued;
+    apr_size_t in_stream_max_size;
+    apr_size_t in_session_max_size;
 };
 
 static void free_response(void *p)
@@ -69,7 +88,7 @@ static int is_aborted(h2_mplx *m, apr_status_t *pstatus) {
     return 0;
 }
 
-static void have_out_data_for(h2_mplx *m, int stream_id);
+static void have_out_data_for(h2_mplx *m, h2_io *io);
 
 /**
  * A h2_mplx needs to be thread-safe *and* if will be called by
@@ -98,6 +117,11 @@ h2_mplx *h2_mplx_create(conn_rec *c, apr_pool_t *parent)
     if (m) {
         m->id = c->id;
         m->c = c;
+        apr_size_t max_mem_free = h2_config_geti(conf, 
+                                                 H2_CONF_SESSION_MAX_MEM_FREE);
+        if (max_mem_free) {
+            apr_allocator_max_free_set(allocator, 1024 * max_mem_free);
+        }
         apr_pool_create_ex(&m->pool, parent, NULL, allocator);
         if (!m->pool) {
             return NULL;
@@ -113,9 +137,28 @@ h2_mplx *h2_mplx_create(conn_rec *c, apr_pool_t *parent)
         m->bucket_alloc = apr_bucket_alloc_create(m->pool);
         m->stream_ios = h2_io_set_create(m->pool);
         m->ready_ios = h2_io_set_create(m->pool);
+        m->continue_ios = h2_io_set_create(m->pool);
+        m->stalled_ios = h2_io_set_create(m->pool);
+        m->consumed_ios = h2_io_set_create(m->pool);
+        m->data_ios = h2_io_set_create(m->pool);
         m->task_finished_ios = h2_io_set_create(m->pool);
+        h2_pool_cache_init(&m->io_pools, m->pool, H2_SPARE_IO_POOLS);
         m->out_stream_max_size = h2_config_geti(conf, 
                                                 H2_CONF_STREAM_MAX_MEM_SIZE);
+        m->out_session_max_size = h2_config_geti(conf, 
+                                                 H2_CONF_SESSION_MAX_MEM_SIZE);
+        m->out_stream_max_spool = h2_config_geti(conf, 
+                                                 H2_CONF_STREAM_MAX_SPOOL_SIZE);
+        m->out_stream_timeout = apr_time_from_sec(
+            h2_config_geti(conf, H2_CONF_STREAM_SEND_TIMEOUT));
+        m->out_stream_min_rate = h2_config_geti(conf, 
+                                                H2_CONF_STREAM_MIN_SEND_RATE);
+        m->in_stream_timeout = apr_time_from_sec(
+            h2_config_geti(conf, H2_CONF_STREAM_RECV_TIMEOUT));
+        m->in_stream_max_size = h2_config_geti(conf, 
+                                               H2_CONF_STREAM_MAX_IN_MEM_SIZE);
+        m->in_session_max_size = h2_config_geti(conf, 
+                                                H2_CONF_SESSION_MAX_IN_MEM_SIZE);
     }
     return m;
 }
@@ -125,13 +168,34 @@ void h2_mplx_destroy(h2_mplx *m)
     assert(m);
     apr_status_t status = apr_thread_mutex_lock(m->lock);
     if (APR_SUCCESS == status) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, m->c,
+                      "h2_mplx(%ld): io pools created/reused: %ld/%ld",
+                      m->id, m->io_pools.created, m->io_pools.reused);
         m->aborted = 1;
+        /* all ios are owned by stream_ios, the other sets only
+         * reference them. */
         if (m->task_finished_ios) {
-            h2_io_set_destroy(m->task_finished_ios);
+            h2_io_set_remove_all(m->task_finished_ios);
             m->task_finished_ios = NULL;
         }
+        if (m->continue_ios) {
+            h2_io_set_remove_all(m->continue_ios);
+            m->continue_ios = NULL;
+        }
+        if (m->stalled_ios) {
+            h2_io_set_remove_all(m->stalled_ios);
+            m->stalled_ios = NULL;
+        }
+        if (m->consumed_ios) {
+            h2_io_set_remove_all(m->consumed_ios);
+            m->consumed_ios = NULL;
+        }
+        if (m->data_ios) {
+            h2_io_set_remove_all(m->data_ios);
+            m->data_ios = NULL;
+        }
         if (m->ready_ios) {
-            h2_io_set_destroy(m->ready_ios);
+            h2_io_set_remove_all(m->ready_ios);
             m->ready_ios = NULL;
         }
         if (m->stream_ios) {
@@ -155,30 +219,6 @@ void h2_mplx_destroy(h2_mplx *m)
     }
 }
 
-static int abort_task(void *ctx, h2_io *io) 
-{
-    h2_mplx *m = (h2_mplx *)ctx;
-    if (io->task) {
-        h2_task_abort(io->task);
-    }
-    return 1;
-}
-
-void h2_mplx_cleanup(h2_mplx *m)
-{
-    assert(m);
-    if (m->aborted) {
-        return;
-    }
-    apr_status_t status = apr_thread_mutex_lock(m->lock);
-    if (APR_SUCCESS == status) {
-        h2_io_set_iter(m->task_finished_ios, abort_task, m);
-        h2_io_set_remove_all(m->task_finished_ios);
-        
-        apr_thread_mutex_unlock(m->lock);
-    }
-}
-
 apr_pool_t *h2_mplx_get_pool(h2_mplx *m)
 {
     assert(m);
@@ -201,51 +241,68 @@ apr_size_t h2_mplx_get_out_max_mem(h2_mplx *m)
     return m->out_stream_max_size;
 }
 
+void h2_mplx_shed(h2_mplx *m)
+{
+    assert(m);
+    apr_status_t status = apr_thread_mutex_lock(m->lock);
+    if (APR_SUCCESS == status) {
+        h2_pool_cache_trim(&m->io_pools, 0);
+        apr_thread_mutex_unlock(m->lock);
+    }
+}
+
 void h2_mplx_abort(h2_mplx *m)
 {
     assert(m);
     apr_status_t status = apr_thread_mutex_lock(m->lock);
     if (APR_SUCCESS == status) {
         m->aborted = 1;
+        h2_io_set_remove_all(m->task_finished_ios);
+        h2_io_set_remove_all(m->ready_ios);
+        h2_io_set_remove_all(m->continue_ios);
+        h2_io_set_remove_all(m->stalled_ios);
+        h2_io_set_remove_all(m->consumed_ios);
+        h2_io_set_remove_all(m->data_ios);
         h2_io_set_destroy_all(m->stream_ios);
         apr_thread_mutex_unlock(m->lock);
     }
 }
 
 
-static void task_finished(void *ctx, h2_task *task) 
+void h2_mplx_task_done(h2_mplx *m, int stream_id)
 {
-    h2_mplx *m = (h2_mplx*)ctx;
     assert(m);
     apr_status_t status = apr_thread_mutex_lock(m->lock);
     if (APR_SUCCESS == status) {
-        m->aborted = 1;
-        h2_io *io = h2_io_set_get(m->stream_ios, task->stream_id);
+        h2_io *io = h2_io_set_get(m->stream_ios, stream_id);
         if (io) {
-            io->task = task;
             h2_io_set_add(m->task_finished_ios, io);
+            if (m->added_output) {
+                /* the session may be waiting for output, wake it to reap */
+                apr_thread_cond_signal(m->added_output);
+            }
         }
         apr_thread_mutex_unlock(m->lock);
     }
 }
 
-apr_status_t h2_mplx_register_task(h2_mplx *m, h2_task *task)
+int h2_mplx_pop_finished(h2_mplx *m)
 {
     assert(m);
     if (m->aborted) {
-        return APR_ECONNABORTED;
+        return 0;
     }
+    int stream_id = 0;
     apr_status_t status = apr_thread_mutex_lock(m->lock);
     if (APR_SUCCESS == status) {
-        h2_io *io = h2_io_set_get(m->stream_ios, task->stream_id);
+        h2_io *io = h2_io_set_get_highest_prio(m->task_finished_ios);
         if (io) {
-            io->task = task;
-            h2_task_on_finished(task, task_finished, m);
+            h2_io_set_remove(m->task_finished_ios, io);
+            stream_id = io->id;
         }
-        status = io? APR_SUCCESS : APR_EINVAL;
         apr_thread_mutex_unlock(m->lock);
     }
-    return status;
+    return stream_id;
 }
 
 apr_status_t h2_mplx_open_io(h2_mplx *m, int stream_id)
@@ -258,8 +315,14 @@ apr_status_t h2_mplx_open_io(h2_mplx *m, int stream_id)
     if (APR_SUCCESS == status) {
         h2_io *io = h2_io_set_get(m->stream_ios, stream_id);
         if (!io) {
-            io = h2_io_create(stream_id, m->pool, m->bucket_alloc);
-            h2_io_set_add(m->stream_ios, io);
+            apr_pool_t *pool = NULL;
+            status = h2_pool_cache_get(&m->io_pools, &pool);
+            if (status == APR_SUCCESS) {
+                io = h2_io_create(stream_id, pool, m->bucket_alloc);
+                if (io) {
+                    h2_io_set_add(m->stream_ios, io);
+                }
+            }
         }
         status = io? APR_SUCCESS : APR_ENOMEM;
         apr_thread_mutex_unlock(m->lock);
@@ -274,13 +337,47 @@ void h2_mplx_close_io(h2_mplx *m, int stream_id)
     if (APR_SUCCESS == status) {
         h2_io *io = h2_io_set_get(m->stream_ios, stream_id);
         if (io) {
+            m->in_queued -= io->input_queued;
+            m->out_queued -= h2_io_out_mem(io);
+            /* releases the io pool with response and buffers, so
+             * nothing may reference it afterwards. */
+            h2_io_set_remove(m->task_finished_ios, io);
+            h2_io_set_remove(m->ready_ios, io);
+            h2_io_set_remove(m->continue_ios, io);
+            h2_io_set_remove(m->stalled_ios, io);
+            h2_io_set_remove(m->consumed_ios, io);
+            h2_io_set_remove(m->data_ios, io);
             h2_io_set_remove(m->stream_ios, io);
-            h2_io_destroy(io);
+            h2_pool_cache_put(&m->io_pools, h2_io_release(io));
         }
         apr_thread_mutex_unlock(m->lock);
     }
 }
 
+/* A task waited in vain for the client, have the session reset the
+ * stream. The task itself gives up with APR_TIMEUP. */
+static apr_status_t stream_stalled(h2_mplx *m, h2_io *io, const char *why)
+{
+    ap_log_cerror(APLOG_MARK, APLOG_INFO, APR_TIMEUP, m->c,
+                  "h2_mplx(%ld-%d): stream stalled, %s", m->id, io->id, why);
+    h2_io_set_add(m->stalled_ios, io);
+    have_out_data_for(m, io);
+    return APR_TIMEUP;
+}
+
+/* Wait on the condition for at most the given time, forever if the
+ * timeout is 0. */
+static void io_wait(h2_mplx *m, apr_thread_cond_t *cond, 
+                    apr_interval_time_t timeout)
+{
+    if (timeout > 0) {
+        apr_thread_cond_timedwait(cond, m->lock, timeout);
+    }
+    else {
+        apr_thread_cond_wait(cond, m->lock);
+    }
+}
+
 apr_status_t h2_mplx_in_read(h2_mplx *m, apr_read_type_e block,
                              int stream_id, struct h2_bucket **pbucket,
                              struct apr_thread_cond_t *iowait)
@@ -293,16 +390,28 @@ apr_status_t h2_mplx_in_read(h2_mplx *m, apr_read_type_e block,
     if (APR_SUCCESS == status) {
         h2_io *io = h2_io_set_get(m->stream_ios, stream_id);
         if (io) {
+            apr_time_t deadline = apr_time_now() + m->in_stream_timeout;
             status = h2_io_in_read(io, pbucket);
             while (status == APR_EAGAIN 
                    && !is_aborted(m, &status)
-                   && block == APR_BLOCK_READ) {
+                   && block == APR_BLOCK_READ
+                   && iowait) {
+                apr_interval_time_t left = deadline - apr_time_now();
+                if (m->in_stream_timeout > 0 && left <= 0) {
+                    status = stream_stalled(m, io, "no request body");
+                    break;
+                }
                 io->input_arrived = iowait;
-                apr_thread_cond_wait(io->input_arrived, m->lock);
+                io_wait(m, io->input_arrived, 
+                        m->in_stream_timeout > 0? left : 0);
                 io->input_arrived = NULL;
                 
                 status = h2_io_in_read(io, pbucket);
             }
+            if (status == APR_SUCCESS) {
+                m->in_queued -= (*pbucket)->data_len;
+                h2_io_set_add(m->consumed_ios, io);
+            }
         }
         else {
             status = APR_EOF;
@@ -323,15 +432,19 @@ apr_status_t h2_mplx_in_write(h2_mplx *m,
     if (APR_SUCCESS == status) {
         h2_io *io = h2_io_set_get(m->stream_ios, stream_id);
         if (io) {
+            apr_size_t len = bucket->data_len;
             status = h2_io_in_write(io, bucket);
+            if (status == APR_SUCCESS) {
+                m->in_queued += len;
+            }
             if (io->input_arrived) {
                 apr_thread_cond_signal(io->input_arrived);
             }
-            apr_thread_mutex_unlock(m->lock);
         }
         else {
             status = APR_EOF;
         }
+        apr_thread_mutex_unlock(m->lock);
     }
     return status;
 }
@@ -360,20 +473,48 @@ apr_status_t h2_mplx_in_close(h2_mplx *m, int stream_id)
 }
 
 typedef struct {
+    h2_mplx *m;
     h2_mplx_consumed_cb *cb;
     void *cb_ctx;
     int streams_updated;
 } update_ctx;
 
+static int over_in_budget(h2_mplx *m, h2_io *io)
+{
+    /* A stream with nothing queued always gets its window back, so that
+     * one stalled stream cannot starve the others of the session budget. */
+    return (io->input_queued >= m->in_stream_max_size
+            || (io->input_queued > 0 
+                && m->in_queued >= m->in_session_max_size));
+}
+
+/* Returns != 0 for ios whose update is held back, so they stay in
+ * the consumed set. */
 static int update_window(void *ctx, h2_io *io)
 {
     if (io->input_consumed) {
         update_ctx *uctx = (update_ctx*)ctx;
+        if (io->window_held) {
+            /* The client was not told to send the body yet, it gets
+             * no more window than it started with. */
+            return 1;
+        }
+        if (over_in_budget(uctx->m, io)) {
+            /* Hold back the window update until the task has read
+             * enough of its input. The client will run out of window
+             * and stop sending for this stream. */
+            ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, uctx->m->c,
+                          "h2_mplx(%ld-%d): input over budget, %ld queued "
+                          "on stream, %ld on session",
+                          uctx->m->id, io->id, (long)io->input_queued,
+                          (long)uctx->m->in_queued);
+            return 1;
+        }
         uctx->cb(uctx->cb_ctx, io->id, io->input_consumed);
         io->input_consumed = 0;
         ++uctx->streams_updated;
     }
-    return 1;
+    return 0;
 }
 
 apr_status_t h2_mplx_in_update_windows(h2_mplx *m, 
@@ -385,8 +526,8 @@ apr_status_t h2_mplx_in_update_windows(h2_mplx *m,
     }
     apr_status_t status = apr_thread_mutex_lock(m->lock);
     if (APR_SUCCESS == status) {
-        update_ctx ctx = { cb, cb_ctx, 0 };
-        h2_io_set_iter(m->stream_ios, update_window, &ctx);
+        update_ctx ctx = { m, cb, cb_ctx, 0 };
+        h2_io_set_filter(m->consumed_ios, update_window, &ctx);
         status = ctx.streams_updated? APR_SUCCESS : APR_EAGAIN;
         apr_thread_mutex_unlock(m->lock);
     }
@@ -394,7 +535,8 @@ apr_status_t h2_mplx_in_update_windows(h2_mplx *m,
 }
 
 apr_status_t h2_mplx_out_read(h2_mplx *m, int stream_id, 
-                              apr_bucket_brigade *bb, apr_size_t maxlen)
+                              apr_bucket_brigade *bb, apr_size_t maxlen,
+                              apr_off_t *pmoved)
 {
     assert(m);
     if (m->aborted) {
@@ -404,7 +546,9 @@ apr_status_t h2_mplx_out_read(h2_mplx *m, int stream_id,
     if (APR_SUCCESS == status) {
         h2_io *io = h2_io_set_get(m->stream_ios, stream_id);
         if (io) {
-            status = h2_io_out_read(io, bb, maxlen);
+            apr_off_t mem = h2_io_out_mem(io);
+            status = h2_io_out_read(io, bb, maxlen, pmoved);
+            m->out_queued += h2_io_out_mem(io) - mem;
             if (status == APR_SUCCESS && io->output_drained) {
                 apr_thread_cond_signal(io->output_drained);
             }
@@ -431,7 +575,10 @@ h2_response *h2_mplx_pop_response(h2_mplx *m, apr_bucket_brigade *bb)
             response = h2_io_extract_response(io);
             h2_io_set_remove(m->ready_ios, io);
             if (bb) {
-                h2_io_out_read(io, bb, 0);
+                /* the first part of the output comes along */
+                apr_off_t mem = h2_io_out_mem(io);
+                h2_io_out_read(io, bb, m->out_stream_max_size, NULL);
+                m->out_queued += h2_io_out_mem(io) - mem;
             }
             ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, m->c,
                           "h2_mplx(%ld): popped response(%d)",
@@ -442,32 +589,170 @@ h2_response *h2_mplx_pop_response(h2_mplx *m, apr_bucket_brigade *bb)
     return response;
 }
 
+int h2_mplx_pop_continue(h2_mplx *m)
+{
+    assert(m);
+    if (m->aborted) {
+        return 0;
+    }
+    int stream_id = 0;
+    apr_status_t status = apr_thread_mutex_lock(m->lock);
+    if (APR_SUCCESS == status) {
+        h2_io *io = h2_io_set_get_highest_prio(m->continue_ios);
+        if (io) {
+            h2_io_set_remove(m->continue_ios, io);
+            io->window_held = 0;
+            if (!io->response) {
+                stream_id = io->id;
+            }
+        }
+        apr_thread_mutex_unlock(m->lock);
+    }
+    return stream_id;
+}
+
+/* Minimum rates are only looked at once the output had time to get
+ * going. */
+#define H2_MIN_RATE_GRACE       apr_time_from_sec(10)
+
+static int out_too_slow(h2_mplx *m, h2_io *io, apr_time_t now)
+{
+    if (m->out_stream_min_rate > 0) {
+        apr_interval_time_t elapsed = now - io->out_started;
+        return (elapsed > H2_MIN_RATE_GRACE 
+                && io->out_drained < m->out_stream_min_rate 
+                                     * apr_time_sec(elapsed));
+    }
+    return 0;
+}
+
+/* How often the drain rate of a stream is sampled, for how long of
+ * that rate a stream may buffer output and how much it may always 
+ * buffer, so that all streams progress in a full session. */
+#define H2_OUT_RATE_SAMPLE      apr_time_from_msec(100)
+#define H2_OUT_BUFFER_TIME      apr_time_from_msec(250)
+#define H2_OUT_MIN_BUDGET       (16 * 1024)
+
+static void out_rate_update(h2_io *io, apr_time_t now)
+{
+    if (!io->out_rate_since) {
+        io->out_rate_since = now;
+        io->out_rate_drained = io->out_drained;
+    }
+    else if (now - io->out_rate_since >= H2_OUT_RATE_SAMPLE) {
+        apr_off_t rate = ((io->out_drained - io->out_rate_drained) 
+                          * APR_USEC_PER_SEC / (now - io->out_rate_since));
+        io->out_rate = io->out_rate? (io->out_rate + rate) / 2 : rate;
+        io->out_rate_since = now;
+        io->out_rate_drained = io->out_drained;
+    }
+}
+
+/* The number of bytes the stream may have in memory. Without a session
+ * limit, it is the configured stream limit. Otherwise the stream may
+ * buffer what its client reads in a quarter second, at least the stream
+ * limit, as long as the session limit has room for it. The client's
+ * flow control window is part of that rate. */
+static apr_off_t out_budget(h2_mplx *m, h2_io *io, apr_time_t now)
+{
+    if (m->out_session_max_size <= 0) {
+        return m->out_stream_max_size;
+    }
+    out_rate_update(io, now);
+    apr_off_t budget = io->out_rate * H2_OUT_BUFFER_TIME / APR_USEC_PER_SEC;
+    if (budget < m->out_stream_max_size) {
+        budget = m->out_stream_max_size;
+    }
+    apr_off_t room = (m->out_session_max_size 
+                      - (m->out_queued - h2_io_out_mem(io)));
+    if (budget > room) {
+        budget = room;
+    }
+    return (budget < H2_OUT_MIN_BUDGET)? H2_OUT_MIN_BUDGET : budget;
+}
+
 static apr_status_t out_write(h2_mplx *m, h2_io *io, 
                               ap_filter_t* f, apr_bucket_brigade *bb,
                               struct apr_thread_cond_t *iowait)
 {
     apr_status_t status = APR_SUCCESS;
     /* We check the memory footprint queued for this stream_id
-     * and block if it exceeds our configured limit.
+     * and block if it exceeds its budget, see out_budget().
      * We will not split buckets to enforce the limit to the last
      * byte. After all, the bucket is already in memory.
+     * Without iowait, the task runs on the session thread that does
+     * the draining, so we queue it all.
      */
+    if (!io->out_started) {
+        io->out_started = apr_time_now();
+    }
     while (!APR_BRIGADE_EMPTY(bb) 
            && (status == APR_SUCCESS)
            && !is_aborted(m, &status)) {
         
-        status = h2_io_out_write(io, bb, m->out_stream_max_size);
+        apr_off_t budget = out_budget(m, io, apr_time_now());
+        apr_off_t mem = h2_io_out_mem(io);
+        if (!iowait) {
+            status = h2_io_out_write(io, bb, 0);
+        }
+        else if (mem < budget) {
+            status = h2_io_out_write(io, bb, (apr_size_t)(budget - mem));
+        }
         
-        /* Wait for data to drain until there is room again */
-        while (!APR_BRIGADE_EMPTY(bb) 
+        m->out_queued += h2_io_out_mem(io) - mem;
+        
+        /* Rather than have the worker wait for a slow client, it spools
+         * what does not fit into memory, as far as the stream may. It
+         * writes its spool without our lock, see h2_mplx_out_spooled(). */
+        if (iowait && !APR_BRIGADE_EMPTY(bb) 
+            && status == APR_SUCCESS
+            && io->spool_len < m->out_stream_max_spool
+            && (budget <= h2_io_out_mem(io))
+            && !APR_BUCKET_IS_METADATA(APR_BRIGADE_FIRST(bb))) {
+            if (!io->spool_in) {
+                ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, f->c,
+                              "h2_mplx(%ld-%d): spooling output", 
+                              m->id, io->id);
+            }
+            return APR_INCOMPLETE;
+        }
+        
+        /* Wait for data to drain until there is room again, as long
+         * as the client keeps reading at all and fast enough. */
+        apr_time_t deadline = apr_time_now() + m->out_stream_timeout;
+        apr_off_t drained = io->out_drained;
+        while (iowait && !APR_BRIGADE_EMPTY(bb) 
                && status == APR_SUCCESS
-               && (m->out_stream_max_size <= h2_io_out_length(io))
+               && (budget <= h2_io_out_mem(io))
                && !is_aborted(m, &status)) {
+            apr_time_t now = apr_time_now();
+            if (io->out_drained != drained) {
+                drained = io->out_drained;
+                deadline = now + m->out_stream_timeout;
+            }
+            if (m->out_stream_timeout > 0 && now >= deadline) {
+                status = stream_stalled(m, io, "response not read");
+                break;
+            }
+            if (out_too_slow(m, io, now)) {
+                status = stream_stalled(m, io, "response read too slowly");
+                break;
+            }
+            
+            apr_interval_time_t timeout = 0;
+            if (m->out_stream_timeout > 0) {
+                timeout = deadline - now;
+            }
+            if (m->out_stream_min_rate > 0 
+                && (timeout <= 0 || timeout > apr_time_from_sec(1))) {
+                /* look at the rate every second */
+                timeout = apr_time_from_sec(1);
+            }
             io->output_drained = iowait;
             ap_log_cerror(APLOG_MARK, APLOG_TRACE1, status, f->c,
                           "h2_mplx(%ld-%d): waiting for out drain", 
                           m->id, io->id);
-            apr_thread_cond_wait(io->output_drained, m->lock);
+            io_wait(m, io->output_drained, timeout);
             io->output_drained = NULL;
         }
     }
@@ -482,15 +767,19 @@ static apr_status_t out_open(h2_mplx *m, int stream_id, h2_response *response,
     
     h2_io *io = h2_io_set_get(m->stream_ios, stream_id);
     if (io) {
-        io->response = h2_response_clone(m->pool, response);
+        io->response = h2_response_clone(io->pool, response);
+        if (io->response) {
+            /* collapsed streams get their response from another one */
+            io->response->stream_id = stream_id;
+        }
         h2_io_set_add(m->ready_ios, io);
-        if (f && bb && iowait) {
+        if (f && bb) {
             ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, f->c,
                           "h2_mplx(%ld-%d): open response",
                           m->id, stream_id);
             status = out_write(m, io, f, bb, iowait);
         }
-        have_out_data_for(m, stream_id);
+        have_out_data_for(m, io);
     }
     else {
         status = APR_ECONNABORTED;
@@ -515,6 +804,54 @@ apr_status_t h2_mplx_out_open(h2_mplx *m, int stream_id, h2_response *response,
 }
 
 
+apr_status_t h2_mplx_in_hold_window(h2_mplx *m, int stream_id)
+{
+    assert(m);
+    if (m->aborted) {
+        return APR_ECONNABORTED;
+    }
+    apr_status_t status = apr_thread_mutex_lock(m->lock);
+    if (APR_SUCCESS == status) {
+        h2_io *io = h2_io_set_get(m->stream_ios, stream_id);
+        if (io) {
+            io->window_held = 1;
+        }
+        else {
+            status = APR_ECONNABORTED;
+        }
+        apr_thread_mutex_unlock(m->lock);
+    }
+    return status;
+}
+
+apr_status_t h2_mplx_out_continue(h2_mplx *m, int stream_id)
+{
+    assert(m);
+    if (m->aborted) {
+        return APR_ECONNABORTED;
+    }
+    apr_status_t status = apr_thread_mutex_lock(m->lock);
+    if (APR_SUCCESS == status) {
+        h2_io *io = h2_io_set_get(m->stream_ios, stream_id);
+        if (io) {
+            if (!io->response) {
+                h2_io_set_add(m->continue_ios, io);
+            }
+            else {
+                /* The response tells the client to go on, no 100 is
+                 * sent. Release the window updates held back for it. */
+                io->window_held = 0;
+            }
+            have_out_data_for(m, io);
+        }
+        else {
+            status = APR_ECONNABORTED;
+        }
+        apr_thread_mutex_unlock(m->lock);
+    }
+    return status;
+}
+
 apr_status_t h2_mplx_out_write(h2_mplx *m, int stream_id, 
                                ap_filter_t* f, apr_bucket_brigade *bb,
                                struct apr_thread_cond_t *iowait)
@@ -528,7 +865,91 @@ apr_status_t h2_mplx_out_write(h2_mplx *m, int stream_id,
         h2_io *io = h2_io_set_get(m->stream_ios, stream_id);
         if (io) {
             status = out_write(m, io, f, bb, iowait);
-            have_out_data_for(m, stream_id);
+            have_out_data_for(m, io);
+        }
+        else {
+            status = APR_ECONNABORTED;
+        }
+        apr_thread_mutex_unlock(m->lock);
+    }
+    return status;
+}
+
+apr_status_t h2_mplx_out_follow(h2_mplx *m, int stream_id, 
+                                h2_response *response,
+                                ap_filter_t* f, apr_bucket_brigade *bb)
+{
+    assert(m);
+    if (m->aborted) {
+        return APR_ECONNABORTED;
+    }
+    apr_status_t status = apr_thread_mutex_lock(m->lock);
+    if (APR_SUCCESS == status) {
+        h2_io *io = h2_io_set_get(m->stream_ios, stream_id);
+        if (!io) {
+            status = APR_ECONNABORTED;
+        }
+        else {
+            if (response) {
+                status = out_open(m, stream_id, response, NULL, NULL, NULL);
+            }
+            if (!io->out_started) {
+                io->out_started = apr_time_now();
+            }
+            /* The writer serves others as well and never waits for us.
+             * What exceeds our budget it spools for us, as a task does,
+             * see h2_mplx_out_spooled(). Since it cannot wait instead,
+             * it does so even when tasks do not spool. Only what exceeds
+             * a configured spool limit resets the stream. */
+            apr_off_t budget = out_budget(m, io, apr_time_now());
+            apr_off_t mem = h2_io_out_mem(io);
+            if (status == APR_SUCCESS) {
+                h2_io_out_meta(io, bb);
+                if (mem < budget) {
+                    status = h2_io_out_write(io, bb, 
+                                             (apr_size_t)(budget - mem));
+                }
+                h2_io_out_meta(io, bb);
+            }
+            m->out_queued += h2_io_out_mem(io) - mem;
+            if (status == APR_SUCCESS && !APR_BRIGADE_EMPTY(bb)) {
+                if (m->out_stream_max_spool <= 0
+                    || io->spool_len < m->out_stream_max_spool) {
+                    if (!io->spool_in) {
+                        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, f->c,
+                                      "h2_mplx(%ld-%d): spooling for "
+                                      "follower", m->id, io->id);
+                    }
+                    status = APR_INCOMPLETE;
+                }
+                else {
+                    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, f->c,
+                                  "h2_mplx(%ld-%d): follower over budget", 
+                                  m->id, io->id);
+                    status = stream_stalled(m, io, "follower read too slowly");
+                }
+            }
+            have_out_data_for(m, io);
+        }
+        apr_thread_mutex_unlock(m->lock);
+    }
+    return status;
+}
+
+apr_status_t h2_mplx_out_spooled(h2_mplx *m, int stream_id, 
+                                 apr_file_t **pspool_in,
+                                 apr_off_t start, apr_off_t len)
+{
+    assert(m);
+    if (m->aborted) {
+        return APR_ECONNABORTED;
+    }
+    apr_status_t status = apr_thread_mutex_lock(m->lock);
+    if (APR_SUCCESS == status) {
+        h2_io *io = h2_io_set_get(m->stream_ios, stream_id);
+        if (io) {
+            status = h2_io_out_spooled(io, pspool_in, start, len);
+            have_out_data_for(m, io);
         }
         else {
             status = APR_ECONNABORTED;
@@ -554,11 +975,11 @@ apr_status_t h2_mplx_out_close(h2_mplx *m, int stream_id)
                  * reset.
                  */
                 h2_response *r = h2_response_create(stream_id, APR_ECONNABORTED, 
-                                                    NULL, NULL, m->pool);
+                                                    NULL, NULL, io->pool);
                 status = out_open(m, stream_id, r, NULL, NULL, NULL);
             }
             status = h2_io_out_close(io);
-            have_out_data_for(m, stream_id);
+            have_out_data_for(m, io);
         }
         else {
             status = APR_ECONNABORTED;
@@ -568,6 +989,52 @@ apr_status_t h2_mplx_out_close(h2_mplx *m, int stream_id)
     return status;
 }
 
+int h2_mplx_pop_stalled(h2_mplx *m)
+{
+    assert(m);
+    if (m->aborted) {
+        return 0;
+    }
+    int stream_id = 0;
+    apr_status_t status = apr_thread_mutex_lock(m->lock);
+    if (APR_SUCCESS == status) {
+        h2_io *io = h2_io_set_get_highest_prio(m->stalled_ios);
+        if (io) {
+            h2_io_set_remove(m->stalled_ios, io);
+            stream_id = io->id;
+        }
+        apr_thread_mutex_unlock(m->lock);
+    }
+    return stream_id;
+}
+
+typedef struct {
+    h2_mplx_stream_cb *cb;
+    void *cb_ctx;
+} data_ctx;
+
+static int report_data(void *ctx, h2_io *io)
+{
+    data_ctx *dctx = (data_ctx*)ctx;
+    dctx->cb(dctx->cb_ctx, io->id);
+    return 1;
+}
+
+void h2_mplx_out_data_iter(h2_mplx *m, h2_mplx_stream_cb *cb, void *ctx)
+{
+    assert(m);
+    if (m->aborted) {
+        return;
+    }
+    apr_status_t status = apr_thread_mutex_lock(m->lock);
+    if (APR_SUCCESS == status) {
+        data_ctx dctx = { cb, ctx };
+        h2_io_set_iter(m->data_ios, report_data, &dctx);
+        h2_io_set_remove_all(m->data_ios);
+        apr_thread_mutex_unlock(m->lock);
+    }
+}
+
 int h2_mplx_in_has_eos_for(h2_mplx *m, int stream_id)
 {
     assert(m);
@@ -624,9 +1091,10 @@ apr_status_t h2_mplx_out_trywait(h2_mplx *m, apr_interval_time_t timeout,
     return status;
 }
 
-static void have_out_data_for(h2_mplx *m, int stream_id)
+static void have_out_data_for(h2_mplx *m, h2_io *io)
 {
     assert(m);
+    h2_io_set_add(m->data_ios, io);
     if (m->added_output) {
         apr_thread_cond_signal(m->added_output);
     }
@@ -31,7 +31,10 @@
  * data, it is blocked until space becomes available.
  *
  * Writing input is never blocked. In order to use flow control on the input,
- * the mplx can be polled for input data consumption.
+ * the mplx can be polled for input data consumption. Consumption is only
+ * reported while the stream stays below "H2StreamMaxInputMemSize" queued
+ * input bytes and the session below "H2SessionMaxInputMemSize". Above
+ * that, window updates are held back until the tasks catch up reading.
  */
 
 struct apr_pool_t;
@@ -80,14 +83,26 @@ conn_rec *h2_mplx_get_conn(h2_mplx *mplx);
  */
 void h2_mplx_abort(h2_mplx *mplx);
 
-/* Register the task reading/writing from/to a stream */
-apr_status_t h2_mplx_register_task(h2_mplx *mplx, struct h2_task *task);
+/**
+ * The task for the stream is done and will not touch the stream again.
+ * Invoked by whoever marked the task finished, after doing so.
+ */
+void h2_mplx_task_done(h2_mplx *mplx, int stream_id);
 
-/* To be invoked regularly in order to cleanup finished tasks */
-void h2_mplx_cleanup(h2_mplx *mplx);
+/**
+ * Gets the id of a stream whose task is done, so that the session can
+ * reap it, if it is a zombie. Returns 0 if there is none.
+ */
+int h2_mplx_pop_finished(h2_mplx *mplx);
 
 apr_size_t h2_mplx_get_out_max_mem(h2_mplx *m);
 
+/**
+ * The session has no open streams. Free what is only kept to make new
+ * streams cheaper.
+ */
+void h2_mplx_shed(h2_mplx *m);
+
 /*******************************************************************************
  * IO lifetime of streams.
  ******************************************************************************/
@@ -97,7 +112,8 @@ apr_size_t h2_mplx_get_out_max_mem(h2_mplx *m);
 apr_status_t h2_mplx_open_io(h2_mplx *mplx, int stream_id);
 
 /**
- * Ends handling of in-/ouput on the given stream id.
+ * Ends handling of in-/ouput on the given stream id. Releases all
+ * memory held for the stream, including its response.
  */
 void h2_mplx_close_io(h2_mplx *mplx, int stream_id);
 
@@ -129,7 +145,8 @@ apr_status_t h2_mplx_in_read(h2_mplx *mplx, apr_read_type_e block,
 
 /**
  * Appends data to the input of the given stream. Storage of input data is
- * not subject to flow control.
+ * never blocked, the amount queued is limited by withholding window
+ * updates, see h2_mplx_in_update_windows().
  */
 apr_status_t h2_mplx_in_write(h2_mplx *mplx, int stream_id, 
                               struct h2_bucket *bucket);
@@ -154,7 +171,9 @@ typedef void h2_mplx_consumed_cb(void *ctx, int stream_id, apr_size_t consumed);
 /**
  * Invoke the callback for all streams that had bytes read since the last
  * call to this function. If no stream had input data consumed, the callback
- * is not invoked.
+ * is not invoked. Only streams that had input read are looked at. Streams
+ * over their input memory budget are skipped and will have their consumed
+ * bytes reported in a later invocation.
  * Returns APR_SUCCESS when an update happened, APR_EAGAIN if no update
  * happened.
  */
@@ -174,25 +193,70 @@ apr_status_t h2_mplx_in_update_windows(h2_mplx *m,
  */
 struct h2_response *h2_mplx_pop_response(h2_mplx *m, apr_bucket_brigade *bb);
 
+/**
+ * Gets the id of a stream whose task started reading a request body the
+ * client holds back until it sees a 100-continue. Returns 0 if there is
+ * none, or the stream already has its final response.
+ */
+int h2_mplx_pop_continue(h2_mplx *m);
+
+/**
+ * Callback invoked for a stream, given by its id.
+ */
+typedef void h2_mplx_stream_cb(void *ctx, int stream_id);
+
+/**
+ * Invoke the callback for all streams that got output, or whose
+ * output got closed, since the last call. The callback is invoked with
+ * the multiplexer locked and must not call back into it.
+ */
+void h2_mplx_out_data_iter(h2_mplx *m, h2_mplx_stream_cb *cb, void *ctx);
+
+/**
+ * Gets the id of a stream whose task gave up waiting on the client, as
+ * it did not send the request body or read the response in time. The
+ * stream needs to be reset. Returns 0 if there is none.
+ */
+int h2_mplx_pop_stalled(h2_mplx *m);
+
 /**
  * Reads output data from the given stream. Will never block, but
  * return APR_EAGAIN until data arrives or the stream is closed.
+ * @param pmoved on return, the number of data bytes added to bb, may be NULL
  */
 apr_status_t h2_mplx_out_read(h2_mplx *mplx, int stream_id, 
-                              apr_bucket_brigade *bb, apr_size_t maxlen);
+                              apr_bucket_brigade *bb, apr_size_t maxlen,
+                              apr_off_t *pmoved);
 
 
 /**
  * Opens the output for the given stream with the specified response.
+ * Writes the brigade as h2_mplx_out_write() does.
  */
 apr_status_t h2_mplx_out_open(h2_mplx *mplx, int stream_id,
                               struct h2_response *response,
                               ap_filter_t* filter, apr_bucket_brigade *bb,
                               struct apr_thread_cond_t *iowait);
 
+/**
+ * Send no window updates for the stream until it is popped by
+ * h2_mplx_pop_continue(). Keeps a client expecting a 100-continue to
+ * its initial window, should it send the body without waiting.
+ */
+apr_status_t h2_mplx_in_hold_window(h2_mplx *mplx, int stream_id);
+
+/**
+ * Announce that the task wants to read the request body, so the client
+ * is sent a 100-continue. Once a response is opened, only the window
+ * updates held back by h2_mplx_in_hold_window() are released.
+ */
+apr_status_t h2_mplx_out_continue(h2_mplx *mplx, int stream_id);
+
 /**
  * Append the brigade to the stream output. Might block if amount
- * of bytes buffered reaches configured max.
+ * of bytes buffered reaches configured max. Returns APR_INCOMPLETE,
+ * with data left in bb, when the caller is to spool it instead, see
+ * h2_mplx_out_spooled().
  * @param stream_id the stream identifier
  * @param filter the apache filter context of the data
  * @param bb the bucket brigade to append
@@ -202,6 +266,35 @@ apr_status_t h2_mplx_out_write(h2_mplx *mplx, int stream_id,
                                ap_filter_t* filter, apr_bucket_brigade *bb,
                                struct apr_thread_cond_t *iowait);
 
+/**
+ * Queue output a task has spooled to a file, for its own stream or a
+ * follower's, without holding the lock while writing it. Limited to H2StreamMaxSpoolSize per stream.
+ * @param stream_id the stream identifier
+ * @param pspool_in a handle to read the spool, taken over on the first
+ *                  call and set to NULL
+ * @param start the offset in the spool of the data to queue
+ * @param len the number of bytes to queue
+ */
+apr_status_t h2_mplx_out_spooled(h2_mplx *mplx, int stream_id, 
+                                 apr_file_t **pspool_in,
+                                 apr_off_t start, apr_off_t len);
+
+/**
+ * Append output written for another stream to this one, opening the
+ * response first if one is given. Never blocks: returns APR_INCOMPLETE,
+ * with data left in bb, when the caller is to spool it instead, see
+ * h2_mplx_out_spooled(), even when H2StreamMaxSpoolSize is 0. Once a
+ * configured spool limit is reached, the stream is reset and APR_TIMEUP
+ * returned.
+ * @param stream_id the stream identifier
+ * @param response the response on the first call, NULL afterwards
+ * @param filter the apache filter context of the data
+ * @param bb the brigade to append, with buckets the stream may own
+ */
+apr_status_t h2_mplx_out_follow(h2_mplx *mplx, int stream_id, 
+                                struct h2_response *response,
+                                ap_filter_t* filter, apr_bucket_brigade *bb);
+
 /**
  * Closes the output stream. Readers of this stream will get all pending 
  * data and then only APR_EOF as result. 
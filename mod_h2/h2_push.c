@@ -0,0 +1,483 @@
+/* Copyright 2015 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+
+#include <apr_lib.h>
+#include <apr_strings.h>
+#include <apr_uri.h>
+
+#include <httpd.h>
+#include <http_core.h>
+#include <http_log.h>
+
+#include "h2_private.h"
+#include "h2_push.h"
+#include "h2_request.h"
+#include "h2_response.h"
+#include "h2_util.h"
+
+typedef struct {
+    apr_pool_t *pool;
+    const h2_request *req;
+    apr_array_header_t *pushes;
+} link_ctx;
+
+static const char *skip_ws(const char *s)
+{
+    while (*s == ' ' || *s == '\t') {
+        ++s;
+    }
+    return s;
+}
+
+static int is_param_end(char c)
+{
+    return (!c || c == ';' || c == ',' || c == '=' || c == ' ' || c == '\t');
+}
+
+/* Return != 0 iff token appears in the space separated list of the 
+ * given length, as in rel="preload stylesheet". */
+static int has_rel(const char *s, apr_size_t len, const char *token)
+{
+    apr_size_t tlen = strlen(token);
+    const char *end = s + len;
+    while (s < end) {
+        while (s < end && apr_isspace(*s)) {
+            ++s;
+        }
+        const char *start = s;
+        while (s < end && !apr_isspace(*s)) {
+            ++s;
+        }
+        if (s - start == tlen && !strncasecmp(start, token, tlen)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Get the path for a link target if it can be pushed on the request's
+ * connection, NULL otherwise. Relative references other than
+ * absolute paths are not resolved and never pushed. */
+static const char *push_path(link_ctx *ctx, const char *uri)
+{
+    if (uri[0] == '/') {
+        return (uri[1] == '/')? NULL : uri;
+    }
+    
+    apr_uri_t parsed;
+    if (apr_uri_parse(ctx->pool, uri, &parsed) != APR_SUCCESS
+        || !parsed.scheme || !parsed.hostinfo) {
+        return NULL;
+    }
+    const char *scheme = ctx->req->scheme? ctx->req->scheme : "http";
+    if (apr_strnatcasecmp(parsed.scheme, scheme)
+        || apr_strnatcasecmp(parsed.hostinfo, ctx->req->authority)) {
+        return NULL;
+    }
+    return apr_uri_unparse(ctx->pool, &parsed, APR_URI_UNP_OMITSITEPART);
+}
+
+static void add_push(link_ctx *ctx, const char *uri)
+{
+    const char *path = push_path(ctx, uri);
+    if (!path || !*path || !strcmp(path, ctx->req->path)) {
+        return;
+    }
+    for (int i = 0; ctx->pushes && i < ctx->pushes->nelts; ++i) {
+        h2_push *push = APR_ARRAY_IDX(ctx->pushes, i, h2_push*);
+        if (!strcmp(path, push->path)) {
+            return;
+        }
+    }
+    
+    h2_push *push = apr_pcalloc(ctx->pool, sizeof(*push));
+    push->path = path;
+    if (!ctx->pushes) {
+        ctx->pushes = apr_array_make(ctx->pool, 5, sizeof(h2_push*));
+    }
+    APR_ARRAY_PUSH(ctx->pushes, h2_push*) = push;
+}
+
+/* Parse one link-value, RFC 5988 ch. 5, starting at s and return the
+ * position after it, which is either a ',' or the end of the string. */
+static const char *parse_link(link_ctx *ctx, const char *s)
+{
+    int preload = 0, nopush = 0;
+    
+    s = skip_ws(s);
+    if (*s != '<') {
+        return s + strcspn(s, ",");
+    }
+    const char *start = ++s;
+    const char *end = strchr(s, '>');
+    if (!end) {
+        return s + strlen(s);
+    }
+    const char *uri = apr_pstrndup(ctx->pool, start, end - start);
+    
+    s = skip_ws(end + 1);
+    while (*s == ';') {
+        s = skip_ws(s + 1);
+        const char *pname = s;
+        while (!is_param_end(*s)) {
+            ++s;
+        }
+        apr_size_t plen = s - pname;
+        const char *pval = NULL;
+        apr_size_t vlen = 0;
+        
+        s = skip_ws(s);
+        if (*s == '=') {
+            s = skip_ws(s + 1);
+            if (*s == '"') {
+                pval = ++s;
+                while (*s && *s != '"') {
+                    if (*s == '\\' && s[1]) {
+                        ++s;
+                    }
+                    ++s;
+                }
+                vlen = s - pval;
+                if (*s) {
+                    ++s;
+                }
+            }
+            else {
+                pval = s;
+                while (!is_param_end(*s)) {
+                    ++s;
+                }
+                vlen = s - pval;
+            }
+            s = skip_ws(s);
+        }
+        
+        if (plen == 3 && !strncasecmp(pname, "rel", 3) && pval) {
+            preload = has_rel(pval, vlen, "preload");
+        }
+        else if (plen == 6 && !strncasecmp(pname, "nopush", 6)) {
+            nopush = 1;
+        }
+    }
+    
+    if (preload && !nopush) {
+        add_push(ctx, uri);
+    }
+    return s + strcspn(s, ",");
+}
+
+static int collect_links(void *data, const char *key, const char *value)
+{
+    link_ctx *ctx = (link_ctx *)data;
+    const char *s = value;
+    while (*s) {
+        s = parse_link(ctx, s);
+        if (*s == ',') {
+            ++s;
+        }
+    }
+    return 1;
+}
+
+apr_array_header_t *h2_push_collect(apr_pool_t *p, const h2_request *req, 
+                                    const h2_response *res)
+{
+    if (!req->method || !req->authority || !req->path || !res->headers) {
+        return NULL;
+    }
+    /* Only successful GET/HEAD responses are worth pushing from. */
+    if ((apr_strnatcasecmp("GET", req->method) 
+         && apr_strnatcasecmp("HEAD", req->method))
+        || !res->http_status || res->http_status[0] != '2') {
+        return NULL;
+    }
+    link_ctx ctx = { p, req, NULL };
+    apr_table_do(collect_links, &ctx, res->headers, "Link", NULL);
+    return ctx.pushes;
+}
+
+/*******************************************************************************
+ * push diary
+ ******************************************************************************/
+
+/* SHA-256, FIPS 180-4, only used to compute diary keys compatible with
+ * cache digests. */
+static const apr_uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR32(x, n)    (((x) >> (n)) | ((x) << (32 - (n))))
+
+typedef struct {
+    apr_uint32_t h[8];
+    unsigned char block[64];
+    apr_size_t blen;
+    apr_uint64_t total;
+} sha256_ctx;
+
+static void sha256_block(sha256_ctx *ctx, const unsigned char *b)
+{
+    apr_uint32_t w[64], v[8];
+    
+    for (int i = 0; i < 16; ++i) {
+        w[i] = ((apr_uint32_t)b[4*i] << 24 | (apr_uint32_t)b[4*i+1] << 16
+                | (apr_uint32_t)b[4*i+2] << 8 | (apr_uint32_t)b[4*i+3]);
+    }
+    for (int i = 16; i < 64; ++i) {
+        apr_uint32_t s0 = (ROTR32(w[i-15], 7) ^ ROTR32(w[i-15], 18) 
+                           ^ (w[i-15] >> 3));
+        apr_uint32_t s1 = (ROTR32(w[i-2], 17) ^ ROTR32(w[i-2], 19) 
+                           ^ (w[i-2] >> 10));
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+    memcpy(v, ctx->h, sizeof(v));
+    for (int i = 0; i < 64; ++i) {
+        apr_uint32_t S1 = ROTR32(v[4], 6) ^ ROTR32(v[4], 11) ^ ROTR32(v[4], 25);
+        apr_uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+        apr_uint32_t t1 = v[7] + S1 + ch + SHA256_K[i] + w[i];
+        apr_uint32_t S0 = ROTR32(v[0], 2) ^ ROTR32(v[0], 13) ^ ROTR32(v[0], 22);
+        apr_uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+        apr_uint32_t t2 = S0 + maj;
+        v[7] = v[6]; v[6] = v[5]; v[5] = v[4]; v[4] = v[3] + t1;
+        v[3] = v[2]; v[2] = v[1]; v[1] = v[0]; v[0] = t1 + t2;
+    }
+    for (int i = 0; i < 8; ++i) {
+        ctx->h[i] += v[i];
+    }
+}
+
+static void sha256_update(sha256_ctx *ctx, const char *data, apr_size_t len)
+{
+    const unsigned char *d = (const unsigned char *)data;
+    ctx->total += len;
+    while (len > 0) {
+        apr_size_t n = sizeof(ctx->block) - ctx->blen;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(ctx->block + ctx->blen, d, n);
+        ctx->blen += n;
+        d += n;
+        len -= n;
+        if (ctx->blen == sizeof(ctx->block)) {
+            sha256_block(ctx, ctx->block);
+            ctx->blen = 0;
+        }
+    }
+}
+
+/* Key of a resource: the first 64 bits of SHA-256 over its URL. */
+static apr_uint64_t diary_key(const char *scheme, const char *authority, 
+                              const char *path)
+{
+    static const apr_uint32_t H0[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    sha256_ctx ctx;
+    memcpy(ctx.h, H0, sizeof(H0));
+    ctx.blen = 0;
+    ctx.total = 0;
+    
+    sha256_update(&ctx, scheme, strlen(scheme));
+    sha256_update(&ctx, "://", 3);
+    sha256_update(&ctx, authority, strlen(authority));
+    sha256_update(&ctx, path, strlen(path));
+    
+    apr_uint64_t bits = ctx.total * 8;
+    unsigned char pad[72];
+    apr_size_t plen = ((ctx.blen < 56)? 56 : 120) - ctx.blen;
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (int i = 0; i < 8; ++i) {
+        pad[plen + i] = (unsigned char)(bits >> (56 - 8*i));
+    }
+    sha256_update(&ctx, (const char *)pad, plen + 8);
+    
+    return ((apr_uint64_t)ctx.h[0] << 32) | ctx.h[1];
+}
+
+struct h2_push_diary {
+    apr_uint64_t *keys;     /* oldest first */
+    int nkeys;
+    int max_keys;
+    apr_uint64_t *digest;   /* keys of the client's last digest, ascending */
+    int ndigest;
+    int digest_bits;        /* significant high bits of digest keys */
+};
+
+h2_push_diary *h2_push_diary_create(apr_pool_t *p, int max_entries)
+{
+    h2_push_diary *diary = NULL;
+    if (max_entries > 0) {
+        diary = apr_pcalloc(p, sizeof(*diary));
+        diary->keys = apr_pcalloc(p, max_entries * sizeof(apr_uint64_t));
+        diary->max_keys = max_entries;
+        diary->digest = apr_pcalloc(p, max_entries * sizeof(apr_uint64_t));
+    }
+    return diary;
+}
+
+static int diary_find(h2_push_diary *diary, apr_uint64_t key)
+{
+    for (int i = diary->nkeys - 1; i >= 0; --i) {
+        if (diary->keys[i] == key) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int digest_has(h2_push_diary *diary, apr_uint64_t key)
+{
+    if (diary->ndigest > 0) {
+        int shift = 64 - diary->digest_bits;
+        apr_uint64_t k = key >> shift;
+        int lo = 0, hi = diary->ndigest - 1;
+        while (lo <= hi) {
+            int mid = lo + (hi - lo) / 2;
+            apr_uint64_t d = diary->digest[mid] >> shift;
+            if (d == k) {
+                return 1;
+            }
+            if (d < k) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid - 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void diary_append(h2_push_diary *diary, apr_uint64_t key)
+{
+    int i = diary_find(diary, key);
+    if (i < 0 && diary->nkeys >= diary->max_keys) {
+        i = 0; /* drop the oldest */
+    }
+    if (i >= 0) {
+        memmove(diary->keys + i, diary->keys + i + 1, 
+                (diary->nkeys - i - 1) * sizeof(apr_uint64_t));
+        --diary->nkeys;
+    }
+    diary->keys[diary->nkeys++] = key;
+}
+
+int h2_push_diary_has(h2_push_diary *diary, const char *scheme,
+                      const char *authority, const char *path)
+{
+    apr_uint64_t key = diary_key(scheme, authority, path);
+    return diary_find(diary, key) >= 0 || digest_has(diary, key);
+}
+
+void h2_push_diary_add(h2_push_diary *diary, const char *scheme,
+                       const char *authority, const char *path)
+{
+    diary_append(diary, diary_key(scheme, authority, path));
+}
+
+typedef struct {
+    const unsigned char *data;
+    apr_size_t len;
+    apr_size_t bit;         /* next bit to read */
+} bit_reader;
+
+static int read_bit(bit_reader *r)
+{
+    if (r->bit >= r->len * 8) {
+        return -1;
+    }
+    int b = (r->data[r->bit / 8] >> (7 - (r->bit % 8))) & 0x01;
+    ++r->bit;
+    return b;
+}
+
+static int read_bits(bit_reader *r, int n, apr_uint64_t *pval)
+{
+    apr_uint64_t val = 0;
+    for (int i = 0; i < n; ++i) {
+        int b = read_bit(r);
+        if (b < 0) {
+            return 0;
+        }
+        val = (val << 1) | b;
+    }
+    *pval = val;
+    return 1;
+}
+
+apr_status_t h2_push_diary_digest_set(h2_push_diary *diary, 
+                                      const char *value, apr_pool_t *pool)
+{
+    unsigned char *data = NULL;
+    apr_size_t len = h2_util_base64url_decode(&data, value, pool);
+    bit_reader r = { data, len, 0 };
+    apr_uint64_t log2n, log2p;
+    
+    /* A new digest replaces the last one, a bad one leaves none. */
+    diary->ndigest = 0;
+    if (!read_bits(&r, 5, &log2n) || !read_bits(&r, 5, &log2p)) {
+        return APR_EINVAL;
+    }
+    int nbits = (int)(log2n + log2p);   /* at most 62 */
+    if (log2p == 0) {
+        return APR_EINVAL;
+    }
+    
+    /* Each entry is the difference to the previous key, minus 1. Only
+     * as many entries as the diary holds are taken, the client may
+     * announce more than we want to look at. */
+    apr_uint64_t n = ((apr_uint64_t)1) << log2n;
+    apr_uint64_t max = ((apr_uint64_t)1) << nbits;
+    apr_uint64_t next = 0;
+    int count = 0;
+    for (apr_uint64_t i = 0; i < n && count < diary->max_keys; ++i) {
+        apr_uint64_t q = 0, rem;
+        int b;
+        while ((b = read_bit(&r)) == 0) {
+            ++q;
+        }
+        if (b < 0 || !read_bits(&r, (int)log2p, &rem)) {
+            break; /* end of data, rest is padding */
+        }
+        if (q >= (((apr_uint64_t)1) << (64 - log2p))) {
+            return APR_EINVAL;
+        }
+        apr_uint64_t delta = (q << log2p) | rem;
+        if (delta >= max - next) {
+            return APR_EINVAL; /* beyond N*P */
+        }
+        apr_uint64_t key = next + delta;
+        diary->digest[count++] = key << (64 - nbits);
+        next = key + 1;
+    }
+    diary->digest_bits = nbits;
+    diary->ndigest = count;
+    return APR_SUCCESS;
+}
@@ -0,0 +1,82 @@
+/* Copyright 2015 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __mod_h2__h2_push__
+#define __mod_h2__h2_push__
+
+struct h2_request;
+struct h2_response;
+
+typedef struct h2_push h2_push;
+
+struct h2_push {
+    const char *path;           /* path (and query) of the resource */
+};
+
+/**
+ * Collect the resources a response announces via "Link: <uri>; rel=preload"
+ * headers, see https://w3c.github.io/preload/, that can be pushed on the
+ * connection of the request. Only resources of the request's authority
+ * are considered and links carrying a "nopush" parameter are skipped.
+ * @param p the pool to allocate in
+ * @param req the request the response answers
+ * @param res the response to inspect
+ * @return array of h2_push*, NULL if there is nothing to push
+ */
+apr_array_header_t *h2_push_collect(apr_pool_t *p, 
+                                    const struct h2_request *req, 
+                                    const struct h2_response *res);
+
+/**
+ * A diary of the resources a session has pushed or knows the client
+ * to have, so they are not pushed again. Entries are keyed by a hash
+ * of the resource URL, the oldest entry is dropped when the diary is
+ * full.
+ */
+typedef struct h2_push_diary h2_push_diary;
+
+/**
+ * Create a diary holding at most max_entries.
+ */
+h2_push_diary *h2_push_diary_create(apr_pool_t *p, int max_entries);
+
+/**
+ * Return != 0 iff the resource is in the diary.
+ */
+int h2_push_diary_has(h2_push_diary *diary, const char *scheme,
+                      const char *authority, const char *path);
+
+/**
+ * Record the resource in the diary. If already present, it becomes
+ * the most recent entry.
+ */
+void h2_push_diary_add(h2_push_diary *diary, const char *scheme,
+                       const char *authority, const char *path);
+
+/**
+ * Take the resources of a cache digest sent by the client, as described
+ * in https://tools.ietf.org/html/draft-kazuho-h2-cache-digest-01: the
+ * base64url encoded Golomb coded set of truncated SHA-256 hashes of the
+ * resource URLs. They replace those of an earlier digest and are only
+ * looked at up to the size of the diary. The diary's own entries keep
+ * being compared in full.
+ * @param diary the diary to prime
+ * @param value the base64url value of the Cache-Digest header
+ * @param pool for temporary allocations
+ */
+apr_status_t h2_push_diary_digest_set(h2_push_diary *diary, 
+                                      const char *value, apr_pool_t *pool);
+
+#endif /* defined(__mod_h2__h2_push__) */
@@ -107,29 +107,28 @@ apr_status_t h2_request_write_header(h2_request *req,
             return APR_EGENERAL;
         }
         
-        if (H2_HEADER_METHOD_LEN == nlen
-            && !strncmp(H2_HEADER_METHOD, name, nlen)) {
-            req->method = apr_pstrndup(req->pool, value, vlen);
-        }
-        else if (H2_HEADER_SCHEME_LEN == nlen
-                 && !strncmp(H2_HEADER_SCHEME, name, nlen)) {
-            req->scheme = apr_pstrndup(req->pool, value, vlen);
-        }
-        else if (H2_HEADER_PATH_LEN == nlen
-                 && !strncmp(H2_HEADER_PATH, name, nlen)) {
-            req->path = apr_pstrndup(req->pool, value, vlen);
-        }
-        else if (H2_HEADER_AUTH_LEN == nlen
-                 && !strncmp(H2_HEADER_AUTH, name, nlen)) {
-            req->authority = apr_pstrndup(req->pool, value, vlen);
-        }
-        else {
-            char buffer[32];
-            memset(buffer, 0, 32);
-            strncpy(buffer, name, (nlen > 31)? 31 : nlen);
-            ap_log_perror(APLOG_MARK, APLOG_INFO, 0, req->pool,
-                          "h2_request(%d): ignoring unknown pseudo header %s",
-                          req->id, buffer);
+        switch (h2_util_hd_classify(name, nlen)) {
+            case H2_HD_P_METHOD:
+                req->method = apr_pstrndup(req->pool, value, vlen);
+                break;
+            case H2_HD_P_SCHEME:
+                req->scheme = apr_pstrndup(req->pool, value, vlen);
+                break;
+            case H2_HD_P_PATH:
+                req->path = apr_pstrndup(req->pool, value, vlen);
+                break;
+            case H2_HD_P_AUTHORITY:
+                req->authority = apr_pstrndup(req->pool, value, vlen);
+                break;
+            default: {
+                char buffer[32];
+                memset(buffer, 0, 32);
+                strncpy(buffer, name, (nlen > 31)? 31 : nlen);
+                ap_log_perror(APLOG_MARK, APLOG_INFO, 0, req->pool,
+                              "h2_request(%d): ignoring unknown pseudo header %s",
+                              req->id, buffer);
+                break;
+            }
         }
     }
     else {
@@ -182,6 +181,36 @@ static apr_status_t insert_request_line(h2_request *req, h2_mplx *m)
                                   req->authority);
 }
 
+apr_off_t h2_request_get_content_length(h2_request *req)
+{
+    return h2_to_h1_get_content_length(req->to_h1);
+}
+
+int h2_request_expects_continue(h2_request *req)
+{
+    return h2_to_h1_expects_continue(req->to_h1);
+}
+
+int h2_request_get_cache_bypass(h2_request *req)
+{
+    return h2_to_h1_get_cache_bypass(req->to_h1);
+}
+
+const char *h2_request_get_if_none_match(h2_request *req)
+{
+    return h2_to_h1_get_if_none_match(req->to_h1);
+}
+
+const char *h2_request_get_variant(h2_request *req)
+{
+    return h2_to_h1_get_variant(req->to_h1);
+}
+
+apr_table_t *h2_request_get_push_headers(h2_request *req)
+{
+    return h2_to_h1_get_push_headers(req->to_h1);
+}
+
 apr_status_t h2_request_flush(h2_request *req, h2_mplx *m)
 {
     return h2_to_h1_flush(req->to_h1);
@@ -63,6 +63,25 @@ apr_status_t h2_request_end_headers(h2_request *req, struct h2_mplx *m);
 
 apr_status_t h2_request_close(h2_request *req, struct h2_mplx *m);
 
+/* Get the announced length of the request body, -1 if unknown. */
+apr_off_t h2_request_get_content_length(h2_request *req);
+
+/* Return != 0 iff the client waits for a 100-continue. */
+int h2_request_expects_continue(h2_request *req);
+
+/* Return != 0 iff the request may not be answered from or stored in the
+ * response cache, e.g. because it carries credentials. */
+int h2_request_get_cache_bypass(h2_request *req);
+
+/* Get the If-None-Match header value, NULL if there is none. */
+const char *h2_request_get_if_none_match(h2_request *req);
+
+/* Get the headers the response commonly varies on, NULL if none. */
+const char *h2_request_get_variant(h2_request *req);
+
+/* Get the headers pushed requests inherit from this one, NULL if none. */
+apr_table_t *h2_request_get_push_headers(h2_request *req);
+
 apr_status_t h2_request_rwrite(h2_request *req, request_rec *r,
                                struct h2_mplx *m);
 
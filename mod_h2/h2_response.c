@@ -29,16 +29,37 @@
 #include "h2_util.h"
 #include "h2_response.h"
 
+static apr_status_t make_nv(h2_response *response, apr_pool_t *pool)
+{
+    const apr_array_header_t *hdrs = apr_table_elts(response->headers);
+    const apr_table_entry_t *entries = (const apr_table_entry_t *)hdrs->elts;
+    
+    response->nvlen = 0;
+    response->nv = apr_palloc(pool, (1 + hdrs->nelts) * sizeof(nghttp2_nv));
+    if (!response->nv) {
+        return APR_ENOMEM;
+    }
+    
+    nghttp2_nv *nv = response->nv;
+    H2_CREATE_NV_LIT_CS(nv, ":status", response->http_status);
+    nv->flags = NGHTTP2_NV_FLAG_NONE;
+    for (int i = 0; i < hdrs->nelts; ++i) {
+        if (entries[i].key) {
+            ++nv;
+            H2_CREATE_NV_CS_CS(nv, entries[i].key, entries[i].val);
+            nv->flags = NGHTTP2_NV_FLAG_NONE;
+        }
+    }
+    response->nvlen = (nv - response->nv) + 1;
+    return APR_SUCCESS;
+}
+
 h2_response *h2_response_create(int stream_id,
                                   apr_status_t task_status,
                                   const char *http_status,
                                   apr_array_header_t *hlines,
                                   apr_pool_t *pool)
 {
-    apr_size_t nvmax = 1 + (hlines? hlines->nelts : 0);
-    /* we allocate one block for the h2_response and the array of
-     * nghtt2_nv structures.
-     */
     h2_response *response = apr_pcalloc(pool, sizeof(h2_response));
     if (response == NULL) {
         return NULL;
@@ -48,7 +69,7 @@ h2_response *h2_response_create(int stream_id,
     response->task_status = task_status;
     response->http_status = http_status;
     response->content_length = -1;
-    response->headers = apr_table_make(pool, hlines->nelts);
+    response->headers = apr_table_make(pool, hlines? hlines->nelts : 0);
 
     if (hlines) {
         int seen_clen = 0;
@@ -62,20 +83,18 @@ h2_response *h2_response_create(int stream_id,
                 /* not valid format, abort */
                 return NULL;
             }
+            apr_size_t nlen = sep - hline;
             (*sep++) = '\0';
             while (*sep == ' ' || *sep == '\t') {
                 ++sep;
             }
-            if (H2_HD_MATCH_LIT_CS("connection", hline)
-                || H2_HD_MATCH_LIT_CS("proxy-connection", hline)
-                || H2_HD_MATCH_LIT_CS("upgrade", hline)
-                || H2_HD_MATCH_LIT_CS("keep-alive", hline)
-                || H2_HD_MATCH_LIT_CS("transfer-encoding", hline)) {
+            h2_hd_t hd = h2_util_hd_classify(hline, nlen);
+            if (H2_HD_IS_CONN_SPECIFIC(hd)) {
                 /* never forward, ch. 8.1.2.2 */
             }
             else {
                 apr_table_merge(response->headers, hline, sep);
-                if (*sep && H2_HD_MATCH_LIT_CS("content-length", hline)) {
+                if (*sep && hd == H2_HD_CONTENT_LENGTH) {
                     char *end;
                     response->content_length = apr_strtoi64(sep, &end, 10);
                     if (sep == end) {
@@ -90,6 +109,10 @@ h2_response *h2_response_create(int stream_id,
         }
 
     }
+    
+    if (response->http_status && make_nv(response, pool) != APR_SUCCESS) {
+        return NULL;
+    }
     return response;
 }
 
@@ -103,7 +126,35 @@ h2_response *h2_response_clone(apr_pool_t *p, h2_response *resp)
     *n = *resp;
     n->http_status = apr_pstrdup(p, resp->http_status);
     n->headers = apr_table_clone(p, resp->headers);
+    if (n->http_status) {
+        if (make_nv(n, p) != APR_SUCCESS) {
+            return NULL;
+        }
+        /* cloned table has the same order, keep the header flags */
+        for (int i = 0; i < n->nvlen; ++i) {
+            n->nv[i].flags = resp->nv[i].flags;
+        }
+    }
     return n;
 }
 
+void h2_response_never_index(h2_response *response, 
+                             const apr_array_header_t *names)
+{
+    if (!names || !response->nv) {
+        return;
+    }
+    /* nv[0] is :status */
+    for (int i = 1; i < response->nvlen; ++i) {
+        nghttp2_nv *nv = &response->nv[i];
+        for (int j = 0; j < names->nelts; ++j) {
+            const char *name = APR_ARRAY_IDX(names, j, const char*);
+            if (!apr_strnatcasecmp(name, (const char *)nv->name)) {
+                nv->flags |= NGHTTP2_NV_FLAG_NO_INDEX;
+                break;
+            }
+        }
+    }
+}
+
 
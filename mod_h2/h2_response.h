@@ -20,6 +20,8 @@
  * suitable prepared to be fed to nghttp2 for response submit. 
  */
 
+#include <nghttp2/nghttp2.h>
+
 struct h2_bucket;
 
 typedef struct h2_response {
@@ -28,6 +30,8 @@ typedef struct h2_response {
     const char *http_status;
     apr_table_t *headers;
     long content_length;
+    nghttp2_nv *nv;         /* :status and headers, ready for submit */
+    apr_size_t nvlen;
 } h2_response;
 
 h2_response *h2_response_create(int stream_id,
@@ -40,4 +44,13 @@ void h2_response_destroy(h2_response *head);
 
 h2_response *h2_response_clone(apr_pool_t *p, h2_response *resp);
 
+/**
+ * Mark all headers whose name is in the given list as never to be
+ * indexed by HPACK, ch. 7.1.3 of RFC 7541.
+ * @param response the response to mark headers in
+ * @param names array of const char* header names, may be NULL
+ */
+void h2_response_never_index(h2_response *response, 
+                             const apr_array_header_t *names);
+
 #endif /* defined(__mod_h2__h2_response__) */
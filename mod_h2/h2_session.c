@@ -16,6 +16,7 @@
 #include <assert.h>
 #include <apr_thread_cond.h>
 #include <apr_base64.h>
+#include <apr_poll.h>
 #include <apr_strings.h>
 
 #include <httpd.h>
@@ -27,14 +28,18 @@
 #include "h2_config.h"
 #include "h2_bucket.h"
 #include "h2_mplx.h"
+#include "h2_push.h"
 #include "h2_response.h"
 #include "h2_stream.h"
 #include "h2_stream_set.h"
 #include "h2_from_h1.h"
+#include "h2_h2.h"
 #include "h2_task.h"
 #include "h2_bucket.h"
 #include "h2_session.h"
 #include "h2_util.h"
+#include "h2_version.h"
+#include "h2_worker.h"
 
 static int frame_print(const nghttp2_frame *frame, char *buffer, size_t maxlen);
 
@@ -53,12 +58,51 @@ static int h2_session_status_from_apr_status(apr_status_t rv)
     }
 }
 
+static int set_hpack_inflate_size(h2_session *session, int size)
+{
+    nghttp2_settings_entry entry = { 
+        NGHTTP2_SETTINGS_HEADER_TABLE_SIZE, size 
+    };
+    return nghttp2_submit_settings(session->ngh2, NGHTTP2_FLAG_NONE, 
+                                   &entry, 1);
+}
+
+/* Nobody has opened a stream for a while, give up what is only there
+ * to serve streams faster. The HPACK table for request headers is 
+ * emptied by announcing a size of 0 until the next stream comes. */
+static void shed_idle(h2_session *session)
+{
+    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c,
+                  "h2_session(%ld): idle, shedding stream state",
+                  session->id);
+    session->shed = 1;
+    h2_pool_cache_trim(session->stream_pools, 0);
+    h2_mplx_shed(session->mplx);
+    if (session->inline_worker) {
+        h2_worker_destroy(session->inline_worker);
+        session->inline_worker = NULL;
+    }
+    
+    if (session->hpack_inflate_size > 0
+        && !set_hpack_inflate_size(session, 0)
+        && !nghttp2_session_send(session->ngh2)) {
+        h2_conn_io_flush(&session->io);
+    }
+}
+
 static int stream_open(h2_session *session, int stream_id)
 {
     if (session->aborted) {
         return NGHTTP2_ERR_CALLBACK_FAILURE;
     }
-    h2_stream * stream = h2_stream_create(stream_id, session->pool,
+    if (session->shed) {
+        /* busy again, the table helps with the requests to come */
+        session->shed = 0;
+        if (session->hpack_inflate_size > 0) {
+            set_hpack_inflate_size(session, session->hpack_inflate_size);
+        }
+    }
+    h2_stream * stream = h2_stream_create(stream_id, session->stream_pools,
                                           session->c->bucket_alloc, 
                                           session->mplx);
     if (!stream) {
@@ -85,6 +129,49 @@ static int stream_open(h2_session *session, int stream_id)
     return 0;
 }
 
+/* Deferred request bodies keep their part of the connection window
+ * until their task runs and reads them. Never let them hold more than
+ * half of it, so other streams can still make progress. */
+#define H2_DEFER_SESSION_MAX    (NGHTTP2_INITIAL_CONNECTION_WINDOW_SIZE / 2)
+
+/* Cleared stream pools kept for the next streams. More than this are
+ * only needed under high concurrency, where pool creation is not what
+ * limits us. */
+#define H2_SPARE_STREAM_POOLS   8
+
+static void stream_start_task(h2_session *session, h2_stream *stream)
+{
+    if (stream->task_deferred) {
+        stream->task_deferred = 0;
+        session->deferred_len -= stream->deferred_len;
+        stream->deferred_len = 0;
+    }
+    if (session->after_stream_opened_cb) {
+        h2_task *task = h2_stream_create_task(stream, session->c);
+        session->after_stream_opened_cb(session, stream, task);
+    }
+}
+
+static int start_deferred_iter(void *ctx, h2_stream *stream)
+{
+    if (stream->task_deferred) {
+        stream_start_task((h2_session *)ctx, stream);
+    }
+    return 1;
+}
+
+static int stream_defer_task(h2_session *session, h2_stream *stream)
+{
+    /* A client expecting a 100-continue will not send the body before
+     * the task asks for it, so we must not wait for it. */
+    if (session->defer_body_max > 0
+        && !h2_request_expects_continue(stream->request)) {
+        apr_off_t clen = h2_request_get_content_length(stream->request);
+        return (clen > 0 && clen <= session->defer_body_max);
+    }
+    return 0;
+}
+
 static apr_status_t stream_end_headers(h2_session *session,
                                        h2_stream *stream, int eos)
 {
@@ -94,9 +181,32 @@ static apr_status_t stream_end_headers(h2_session *session,
             status = h2_stream_write_eos(stream);
         }
         
-        if (status == APR_SUCCESS && session->after_stream_opened_cb) {
-            h2_task *task = h2_stream_create_task(stream, session->c);
-            session->after_stream_opened_cb(session, stream, task);
+        if (status == APR_SUCCESS) {
+            if (eos && h2_stream_serve_cached(stream) == APR_SUCCESS) {
+                /* A hot response we hold ourselves, no task needed. */
+                status = h2_session_handle_response(session, stream);
+            }
+            else if (eos && h2_util_in_locations(session->collapse_locations,
+                                                 stream->request->path)
+                     && h2_stream_join_flight(stream) == APR_SUCCESS) {
+                /* Identical request in flight, its task answers us. */
+                ++session->collapsed_count;
+            }
+            else if (!eos && stream_defer_task(session, stream)) {
+                /* Small body announced, start the task once it has
+                 * arrived, instead of having a worker wait for it. */
+                stream->task_deferred = 1;
+                ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c,
+                              "h2_stream(%ld-%d): task deferred until "
+                              "request body is complete",
+                              session->id, stream->id);
+            }
+            else {
+                if (!eos && h2_request_expects_continue(stream->request)) {
+                    h2_mplx_in_hold_window(session->mplx, stream->id);
+                }
+                stream_start_task(session, stream);
+            }
         }
     }
     return status;
@@ -168,6 +278,17 @@ static int on_data_chunk_recv_cb(nghttp2_session *ngh2, uint8_t flags,
     ap_log_cerror(APLOG_MARK, APLOG_TRACE1, status, session->c,
                   "h2_stream(%ld-%d): written DATA, length %ld",
                   session->id, stream_id, len);
+    if (status == APR_SUCCESS && stream->task_deferred) {
+        stream->deferred_len += len;
+        session->deferred_len += len;
+        if (stream->deferred_len > session->defer_body_max) {
+            /* client sends more than announced, stop waiting */
+            stream_start_task(session, stream);
+        }
+        else if (session->deferred_len >= H2_DEFER_SESSION_MAX) {
+            h2_stream_set_iter(session->streams, start_deferred_iter, session);
+        }
+    }
     return (status == APR_SUCCESS)? 0 : NGHTTP2_ERR_PROTO;
 }
 
@@ -196,6 +317,13 @@ static int on_frame_send_cb(nghttp2_session *ngh2,
     h2_session *session = (h2_session *)userp;
     ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c,
                   "h2_session(%ld): on_frame_send", session->id);
+    if (frame->hd.type == NGHTTP2_HEADERS) {
+        for (size_t i = 0; i < frame->headers.nvlen; ++i) {
+            session->hd_out_raw += (frame->headers.nva[i].namelen
+                                    + frame->headers.nva[i].valuelen);
+        }
+        session->hd_out_encoded += frame->hd.length;
+    }
     return 0;
 }
 
@@ -225,6 +353,9 @@ static apr_status_t close_active_stream(h2_session *session,
                   session->id, (int)stream->id);
     
     h2_stream_set_remove(session->streams, stream);
+    if (stream->task_deferred) {
+        session->deferred_len -= stream->deferred_len;
+    }
     if (session->before_stream_close_cb && stream->task) {
         status = session->before_stream_close_cb(session, stream,
                                                  stream->task, join);
@@ -266,6 +397,13 @@ static int on_stream_close_cb(nghttp2_session *ngh2, int32_t stream_id,
         return NGHTTP2_ERR_CALLBACK_FAILURE;
     }
     h2_stream *stream = h2_stream_set_get(session->streams, stream_id);
+    if (stream && error_code && !(stream_id & 0x01) && session->push_diary) {
+        /* The client refused our push, do not offer it again. */
+        h2_request *req = stream->request;
+        h2_push_diary_add(session->push_diary, 
+                          req->scheme? req->scheme : "http", 
+                          req->authority, req->path);
+    }
     if (stream) {
         apr_status_t status = close_active_stream(session, stream, 0);
     }
@@ -305,6 +443,19 @@ static int on_header_cb(nghttp2_session *ngh2, const nghttp2_frame *frame,
         return NGHTTP2_ERR_INVALID_STREAM_ID;
     }
     
+    session->hd_in_raw += namelen + valuelen;
+    if (session->push_diary 
+        && h2_util_hd_classify((const char *)name, namelen) 
+           == H2_HD_CACHE_DIGEST) {
+        const char *digest = apr_pstrndup(stream->pool, (const char *)value,
+                                          valuelen);
+        if (h2_push_diary_digest_set(session->push_diary, digest, 
+                                     stream->pool) != APR_SUCCESS) {
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, APR_EINVAL, session->c,
+                          "h2_stream(%ld-%d): invalid cache digest",
+                          session->id, stream->id);
+        }
+    }
     apr_status_t status = h2_stream_write_header(stream,
                                                (const char *)name, namelen,
                                                (const char *)value, valuelen);
@@ -342,6 +493,16 @@ static int on_frame_recv_cb(nghttp2_session *ng2s,
                 return NGHTTP2_ERR_INVALID_STREAM_ID;
             }
             
+            /* header block only, without padding and priority fields.
+             * nghttp2's padlen counts the Pad Length byte as well. */
+            apr_size_t hd_len = frame->hd.length;
+            if (frame->hd.flags & NGHTTP2_FLAG_PADDED) {
+                hd_len -= frame->headers.padlen;
+            }
+            if (frame->hd.flags & NGHTTP2_FLAG_PRIORITY) {
+                hd_len -= 5;
+            }
+            session->hd_in_encoded += hd_len;
             if (frame->hd.flags & NGHTTP2_FLAG_END_HEADERS) {
                 int eos = (frame->hd.flags & NGHTTP2_FLAG_END_STREAM);
                 status = stream_end_headers(session, stream, eos);
@@ -380,6 +541,9 @@ static int on_frame_recv_cb(nghttp2_session *ng2s,
             ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, session->c,
                           "h2_stream(%ld-%d): input closed",
                           session->id, (int)frame->hd.stream_id);
+            if (status == APR_SUCCESS && stream->task_deferred) {
+                stream_start_task(session, stream);
+            }
         }
     }
     
@@ -450,9 +614,42 @@ static h2_session *h2_session_create_int(conn_rec *c,
         
         session->streams = h2_stream_set_create(session->pool);
         session->zombies = h2_stream_set_create(session->pool);
+        session->stream_pools = apr_pcalloc(session->pool, 
+                                            sizeof(h2_pool_cache));
+        h2_pool_cache_init(session->stream_pools, session->pool, 
+                           H2_SPARE_STREAM_POOLS);
         
         session->mplx = h2_mplx_create(c, session->pool);
         
+        session->push_enabled = h2_config_geti(config, H2_CONF_PUSH);
+        if (session->push_enabled) {
+            session->push_diary = h2_push_diary_create(session->pool, 
+                h2_config_geti(config, H2_CONF_PUSH_DIARY_SIZE));
+        }
+        
+        session->inline_locations = config->inline_locations;
+        if (!h2_h2_has_client_cert(c)) {
+            /* others' responses are not for someone known by certificate */
+            session->collapse_locations = config->collapse_locations;
+        }
+        session->idle_shed_timeout = apr_time_from_sec(
+            h2_config_geti(config, H2_CONF_IDLE_SHED_SECS));
+        session->hpack_inflate_size = h2_config_geti(config, 
+                                                H2_CONF_HPACK_INFLATE_SIZE);
+        
+        /* A deferred body has to fit into the stream window and input
+         * budget, or the client will never be able to send it all. */
+        session->defer_body_max = h2_config_geti(config, 
+                                                 H2_CONF_DEFER_BODY_MAX_SIZE);
+        apr_size_t limit = h2_config_geti(config, H2_CONF_WIN_SIZE);
+        if (session->defer_body_max > limit) {
+            session->defer_body_max = limit;
+        }
+        limit = h2_config_geti(config, H2_CONF_STREAM_MAX_IN_MEM_SIZE);
+        if (session->defer_body_max > limit) {
+            session->defer_body_max = limit;
+        }
+        
         h2_conn_io_init(&session->io, c, 0);
         
         apr_status_t status = init_callbacks(c, &callbacks);
@@ -485,6 +682,13 @@ static h2_session *h2_session_create_int(conn_rec *c,
          * get flooded by nghttp2. */
         nghttp2_option_set_no_auto_window_update(options, 1);
         
+#if NGHTTP2_HAS_DEFLATE_TABLE_SIZE
+        /* Never use more than this for compressing our headers, even
+         * if the client allows a larger table. */
+        nghttp2_option_set_max_deflate_dynamic_table_size(options, 
+            h2_config_geti(config, H2_CONF_HPACK_DEFLATE_SIZE));
+#endif
+        
         rv = nghttp2_session_server_new2(&session->ngh2, callbacks,
                                          session, options);
         nghttp2_session_callbacks_del(callbacks);
@@ -502,25 +706,18 @@ static h2_session *h2_session_create_int(conn_rec *c,
     return session;
 }
 
-static int stream_close_finished(void *ctx, h2_stream *stream) {
-    assert(ctx);
-    h2_session *session = (h2_session *)ctx;
-    h2_task *task = stream->task;
-    if (!task || h2_task_has_finished(task)) {
-        ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, session->c,
-                      "h2_session(%ld): reaping zombie stream(%d)",
-                      session->id, stream->id);
-        h2_stream_set_remove(session->zombies, stream);
-        h2_stream_destroy(stream);
-    }
-    return 1;
-}
-
 static void reap_zombies(h2_session *session) {
-    h2_mplx_cleanup(session->mplx);
-    if (session->zombies) {
-        /* remove all zombies, where the task has run */
-        h2_stream_set_iter(session->zombies, stream_close_finished, session);
+    /* only look at streams whose task is done, not at all zombies */
+    int stream_id;
+    while ((stream_id = h2_mplx_pop_finished(session->mplx)) > 0) {
+        h2_stream *stream = h2_stream_set_get(session->zombies, stream_id);
+        if (stream) {
+            ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, session->c,
+                          "h2_session(%ld): reaping zombie stream(%d)",
+                          session->id, stream->id);
+            h2_stream_set_remove(session->zombies, stream);
+            h2_stream_destroy(stream);
+        }
     }
 }
 
@@ -549,6 +746,21 @@ static int close_zombie_iter(void *ctx, h2_stream *stream) {
 void h2_session_destroy(h2_session *session)
 {
     assert(session);
+    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c,
+                  "h2_session(%ld): header bytes raw/encoded, "
+                  "in: %ld/%ld, out: %ld/%ld", session->id,
+                  (long)session->hd_in_raw, (long)session->hd_in_encoded,
+                  (long)session->hd_out_raw, (long)session->hd_out_encoded);
+    if (session->inline_locations) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c,
+                      "h2_session(%ld): %ld requests processed inline",
+                      session->id, (long)session->inline_count);
+    }
+    if (session->collapse_locations) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c,
+                      "h2_session(%ld): %ld requests collapsed",
+                      session->id, (long)session->collapsed_count);
+    }
     if (session->streams) {
         if (h2_stream_set_size(session->streams)) {
             ap_log_cerror(APLOG_MARK, APLOG_INFO, 0, session->c,
@@ -577,6 +789,12 @@ void h2_session_destroy(h2_session *session)
         h2_stream_set_destroy(session->zombies);
         session->zombies = NULL;
     }
+    if (session->stream_pools) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c,
+                      "h2_session(%ld): stream pools created/reused: %ld/%ld",
+                      session->id, session->stream_pools->created, 
+                      session->stream_pools->reused);
+    }
     if (session->ngh2) {
         nghttp2_session_del(session->ngh2);
         session->ngh2 = NULL;
@@ -591,6 +809,10 @@ void h2_session_destroy(h2_session *session)
         apr_thread_cond_destroy(session->iowait);
         session->iowait = NULL;
     }
+    if (session->inline_worker) {
+        h2_worker_destroy(session->inline_worker);
+        session->inline_worker = NULL;
+    }
     
     if (session->pool) {
         apr_pool_destroy(session->pool);
@@ -741,6 +963,8 @@ apr_status_t h2_session_start(h2_session *session, int *rv)
             h2_config_geti(config, H2_CONF_WIN_SIZE) },
         {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 
             h2_config_geti(config, H2_CONF_MAX_STREAMS) }, 
+        { NGHTTP2_SETTINGS_HEADER_TABLE_SIZE,
+            session->hpack_inflate_size },
     };
     *rv = nghttp2_submit_settings(session->ngh2, NGHTTP2_FLAG_NONE,
                                  settings,
@@ -777,29 +1001,22 @@ typedef struct {
     int resume_count;
 } resume_ctx;
 
-static h2_stream *resume_on_data(void *ctx, h2_stream *stream) {
+static void resume_on_data(void *ctx, int stream_id) {
     resume_ctx *rctx = (resume_ctx*)ctx;
     h2_session *session = rctx->session;
     assert(session);
-    assert(stream);
     
-    if (h2_stream_is_suspended(stream)) {
-        ap_log_perror(APLOG_MARK, APLOG_DEBUG, 0, stream->pool,
-                      "h2_stream(%ld-%d): suspended, checking for DATA",
-                      h2_mplx_get_id(stream->m), stream->id);
-        if (h2_mplx_out_has_data_for(stream->m, h2_stream_get_id(stream))) {
-            h2_stream_set_suspended(stream, 0);
-            ++rctx->resume_count;
-            
-            int rv = nghttp2_session_resume_data(session->ngh2,
-                                                 h2_stream_get_id(stream));
-            ap_log_cerror(APLOG_MARK, nghttp2_is_fatal(rv)?
-                          APLOG_ERR : APLOG_DEBUG, 0, session->c,
-                          "h2_stream(%ld-%d): resuming stream %s",
-                          session->id, stream->id, nghttp2_strerror(rv));
-        }
+    h2_stream *stream = h2_session_get_stream(session, stream_id);
+    if (stream && h2_stream_is_suspended(stream)) {
+        h2_stream_set_suspended(stream, 0);
+        ++rctx->resume_count;
+        
+        int rv = nghttp2_session_resume_data(session->ngh2, stream_id);
+        ap_log_cerror(APLOG_MARK, nghttp2_is_fatal(rv)?
+                      APLOG_ERR : APLOG_DEBUG, 0, session->c,
+                      "h2_stream(%ld-%d): resuming stream %s",
+                      session->id, stream->id, nghttp2_strerror(rv));
     }
-    return NULL;
 }
 
 static int h2_session_resume_streams_with_data(h2_session *session) {
@@ -807,9 +1024,9 @@ static int h2_session_resume_streams_with_data(h2_session *session) {
     if (!h2_stream_set_is_empty(session->streams)
         && session->mplx && !session->aborted) {
         resume_ctx ctx = { session, 0 };
-        /* Resume all streams where we have data in the out queue and
-         * which had been suspended before. */
-        h2_stream_set_find(session->streams, resume_on_data, &ctx);
+        /* Resume the suspended streams that got DATA in the out queue
+         * since we last looked. Only those are reported by the mplx. */
+        h2_mplx_out_data_iter(session->mplx, resume_on_data, &ctx);
         return ctx.resume_count;
     }
     return 0;
@@ -826,6 +1043,24 @@ static apr_status_t h2_session_update_windows(h2_session *session)
     return h2_mplx_in_update_windows(session->mplx, update_window, session);
 }
 
+static apr_status_t submit_continue(h2_session *session, int stream_id)
+{
+    nghttp2_nv nv = { 
+        (uint8_t *)":status", (uint8_t *)"100", 7, 3, NGHTTP2_NV_FLAG_NONE 
+    };
+    
+    int rv = nghttp2_submit_headers(session->ngh2, NGHTTP2_FLAG_NONE,
+                                    stream_id, NULL, &nv, 1, NULL);
+    ap_log_cerror(APLOG_MARK, rv? APLOG_ERR : APLOG_DEBUG, 0, session->c,
+                  "h2_stream(%ld-%d): submit 100-continue: %s",
+                  session->id, stream_id, nghttp2_strerror(rv));
+    if (nghttp2_is_fatal(rv)) {
+        h2_session_abort_int(session, rv);
+        return APR_ECONNABORTED;
+    }
+    return APR_SUCCESS;
+}
+
 apr_status_t h2_session_write(h2_session *session, apr_interval_time_t timeout)
 {
     apr_status_t status = APR_EAGAIN;
@@ -857,6 +1092,31 @@ apr_status_t h2_session_write(h2_session *session, apr_interval_time_t timeout)
         have_written = 1;
     }
     
+    /* Tell clients waiting on a 100-continue to send the body, before
+     * any final responses go out. */
+    int stream_id;
+    while ((stream_id = h2_mplx_pop_continue(session->mplx)) > 0) {
+        h2_stream *stream = h2_session_get_stream(session, stream_id);
+        if (stream && !stream->response) {
+            status = submit_continue(session, stream_id);
+            have_written = 1;
+        }
+    }
+    
+    /* Reset streams whose tasks gave up on the client. */
+    while ((stream_id = h2_mplx_pop_stalled(session->mplx)) > 0) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c,
+                      "h2_session(%ld): reset stalled stream %d",
+                      session->id, stream_id);
+        int rv = nghttp2_submit_rst_stream(session->ngh2, NGHTTP2_FLAG_NONE,
+                                           stream_id, NGHTTP2_CANCEL);
+        if (nghttp2_is_fatal(rv)) {
+            h2_session_abort_int(session, rv);
+            return APR_ECONNABORTED;
+        }
+        have_written = 1;
+    }
+    
     /* If we have responses ready, submit them now. */
     apr_brigade_cleanup(session->bbtmp);
     while ((response = h2_session_pop_response(session, 
@@ -942,9 +1202,44 @@ static apr_status_t session_receive(const char *data, apr_size_t len,
     return APR_SUCCESS;
 }
 
+/* Wait for the client without any streams open. After the idle shed 
+ * timeout, shed state and go on waiting with the connection's timeout.
+ * The socket is polled and its timeout left alone: a read timing out 
+ * in the middle of a TLS record would break the connection. What the
+ * input filters, e.g. mod_ssl, hold already is read right away. */
+static apr_status_t read_idle(h2_session *session)
+{
+    apr_status_t status = h2_conn_io_read(&session->io, APR_NONBLOCK_READ, 
+                                          session_receive, session);
+    if (!APR_STATUS_IS_EAGAIN(status)) {
+        return status;
+    }
+    
+    apr_pollfd_t pfd;
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.p = session->c->pool;
+    pfd.desc_type = APR_POLL_SOCKET;
+    pfd.reqevents = APR_POLLIN;
+    pfd.desc.s = ap_get_module_config(session->c->conn_config, &core_module);
+    apr_int32_t nsds = 0;
+    status = apr_poll(&pfd, 1, &nsds, session->idle_shed_timeout);
+    if (APR_STATUS_IS_TIMEUP(status)) {
+        shed_idle(session);
+    }
+    return h2_conn_io_read(&session->io, APR_BLOCK_READ, 
+                           session_receive, session);
+}
+
 apr_status_t h2_session_read(h2_session *session, apr_read_type_e block)
 {
     assert(session);
+    if (block == APR_BLOCK_READ && !session->shed 
+        && session->idle_shed_timeout > 0 
+        && session->frames_received > 1
+        && h2_stream_set_is_empty(session->streams)
+        && h2_stream_set_is_empty(session->zombies)) {
+        return read_idle(session);
+    }
     return h2_conn_io_read(&session->io, block, session_receive, session);
 }
 
@@ -1042,32 +1337,8 @@ static ssize_t stream_data_cb(nghttp2_session *ng2s,
     return (ssize_t)nread;
 }
 
-typedef struct {
-    nghttp2_nv *nv;
-    size_t nvlen;
-    size_t offset;
-} nvctx_t;
-
-static int count_headers(void *ctx, const char *key, const char *value)
-{
-    nvctx_t *nvctx = (nvctx_t*)ctx;
-    nvctx->nvlen++;
-    return 1;
-}
-
-static int add_headers(void *ctx, const char *key, const char *value)
-{
-    nvctx_t *nvctx = (nvctx_t*)ctx;
-    if (nvctx->offset < nvctx->nvlen) {
-        H2_CREATE_NV_CS_CS((&nvctx->nv[nvctx->offset]), key, value);
-        nvctx->offset++;
-    }
-    return 1;
-}
-
 static int submit_response(h2_session *session, h2_response *response)
 {
-    nvctx_t nvctx = { NULL, 1 };
     nghttp2_data_provider provider = {
         response->stream_id, stream_data_cb
     };
@@ -1076,28 +1347,18 @@ static int submit_response(h2_session *session, h2_response *response)
                   "h2_stream(%ld-%d): submitting response %s",
                   session->id, response->stream_id, response->http_status);
     
-    apr_table_do(count_headers, &nvctx, response->headers, NULL);
-    nvctx.nv = calloc(nvctx.nvlen, sizeof(nghttp2_nv));
-    if (!nvctx.nv) {
-        return NGHTTP2_ERR_NOMEM;
-    }
-    
-    H2_CREATE_NV_LIT_CS((&nvctx.nv[0]), ":status", response->http_status);
-    nvctx.offset = 1;
-    apr_table_do(add_headers, &nvctx, response->headers, NULL);
-    
     if (APLOGctrace2(session->c)) {
-        for (int i = 0; i < nvctx.nvlen; ++i) {
+        for (int i = 0; i < response->nvlen; ++i) {
             ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c,
                           "h2_stream(%ld-%d): resp header %s: %s",
                           session->id, response->stream_id, 
-                          nvctx.nv[i].name, nvctx.nv[i].value);
+                          response->nv[i].name, response->nv[i].value);
         }
     }
     
     int rv = nghttp2_submit_response(session->ngh2, response->stream_id,
-                                     nvctx.nv, nvctx.nvlen, &provider);
-    free(nvctx.nv);
+                                     response->nv, response->nvlen, 
+                                     &provider);
     
     if (rv != 0) {
         ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, session->c,
@@ -1113,6 +1374,122 @@ static int submit_response(h2_session *session, h2_response *response)
     return rv;
 }
 
+static int add_push_nv(void *ctx, const char *key, const char *value)
+{
+    apr_array_header_t *nva = ctx;
+    nghttp2_nv *nv = &APR_ARRAY_PUSH(nva, nghttp2_nv);
+    nv->name = (uint8_t *)key;
+    nv->namelen = strlen(key);
+    nv->value = (uint8_t *)value;
+    nv->valuelen = strlen(value);
+    nv->flags = NGHTTP2_NV_FLAG_NONE;
+    return 1;
+}
+
+/* Promise a resource on the given client stream and open the stream
+ * the promised request is processed on, like one sent by the client.
+ * Besides the pseudo headers, the promised request carries what the
+ * client would send for it itself, e.g. its Accept-Encoding, see
+ * h2_request_get_push_headers().
+ */
+static h2_stream *submit_push(h2_session *session, h2_stream *is, 
+                              h2_push *push)
+{
+    h2_request *req = is->request;
+    const char *scheme = req->scheme? req->scheme : "http";
+    const nghttp2_nv pseudo[] = {
+        { (uint8_t *)":method", (uint8_t *)"GET", 7, 3, 
+            NGHTTP2_NV_FLAG_NONE },
+        { (uint8_t *)":scheme", (uint8_t *)scheme, 7, strlen(scheme), 
+            NGHTTP2_NV_FLAG_NONE },
+        { (uint8_t *)":authority", (uint8_t *)req->authority, 10, 
+            strlen(req->authority), NGHTTP2_NV_FLAG_NONE },
+        { (uint8_t *)":path", (uint8_t *)push->path, 5, 
+            strlen(push->path), NGHTTP2_NV_FLAG_NONE },
+    };
+    apr_table_t *headers = h2_request_get_push_headers(req);
+    apr_array_header_t *nvs = apr_array_make(is->pool, 8, sizeof(nghttp2_nv));
+    for (size_t i = 0; i < sizeof(pseudo)/sizeof(pseudo[0]); ++i) {
+        APR_ARRAY_PUSH(nvs, nghttp2_nv) = pseudo[i];
+    }
+    if (headers) {
+        apr_table_do(add_push_nv, nvs, headers, NULL);
+    }
+    const nghttp2_nv *nva = (const nghttp2_nv *)nvs->elts;
+    size_t nvlen = nvs->nelts;
+    
+    int32_t pid = nghttp2_submit_push_promise(session->ngh2, 
+                                              NGHTTP2_FLAG_NONE, is->id,
+                                              nva, nvlen, NULL);
+    if (pid <= 0) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c,
+                      "h2_stream(%ld-%d): submit push promise for %s: %s",
+                      session->id, is->id, push->path, 
+                      nghttp2_strerror(pid));
+        return NULL;
+    }
+    
+    h2_stream *stream = NULL;
+    apr_status_t status = APR_EGENERAL;
+    if (stream_open(session, pid) == 0) {
+        stream = h2_session_get_stream(session, pid);
+        status = APR_SUCCESS;
+        for (size_t i = 0; i < nvlen && status == APR_SUCCESS; ++i) {
+            status = h2_stream_write_header(stream, 
+                                            (const char *)nva[i].name, 
+                                            nva[i].namelen,
+                                            (const char *)nva[i].value, 
+                                            nva[i].valuelen);
+        }
+        if (status == APR_SUCCESS) {
+            status = stream_end_headers(session, stream, 1);
+        }
+    }
+    
+    if (status != APR_SUCCESS) {
+        ap_log_cerror(APLOG_MARK, APLOG_ERR, status, session->c,
+                      "h2_stream(%ld-%d): unable to start push of %s",
+                      session->id, pid, push->path);
+        nghttp2_submit_rst_stream(session->ngh2, NGHTTP2_FLAG_NONE, pid,
+                                  NGHTTP2_INTERNAL_ERROR);
+        return NULL;
+    }
+    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c,
+                  "h2_stream(%ld-%d): pushing %s on stream %d",
+                  session->id, is->id, push->path, pid);
+    return stream;
+}
+
+static void submit_pushes(h2_session *session, h2_stream *stream)
+{
+    /* Only streams opened by the client can carry promises. */
+    if (!session->push_enabled || !(stream->id & 0x01)
+        || !nghttp2_session_get_remote_settings(session->ngh2, 
+                                    NGHTTP2_SETTINGS_ENABLE_PUSH)) {
+        return;
+    }
+    apr_array_header_t *pushes = h2_push_collect(stream->pool, 
+                                                 stream->request, 
+                                                 stream->response);
+    const char *scheme = (stream->request->scheme? 
+                          stream->request->scheme : "http");
+    for (int i = 0; pushes && i < pushes->nelts; ++i) {
+        h2_push *push = APR_ARRAY_IDX(pushes, i, h2_push*);
+        if (session->push_diary) {
+            if (h2_push_diary_has(session->push_diary, scheme, 
+                                  stream->request->authority, push->path)) {
+                ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, session->c,
+                              "h2_stream(%ld-%d): already pushed %s",
+                              session->id, stream->id, push->path);
+                continue;
+            }
+            h2_push_diary_add(session->push_diary, scheme, 
+                              stream->request->authority, push->path);
+        }
+        submit_push(session, stream, push);
+    }
+}
+
 /* Start submitting the response to a stream request. This is possible
  * once we have all the response headers. The response body will be
  * read by the session using the callback we supply.
@@ -1126,6 +1503,8 @@ apr_status_t h2_session_handle_response(h2_session *session, h2_stream *stream)
     apr_status_t status = APR_SUCCESS;
     int rv = 0;
     if (stream->response->http_status) {
+        /* promises go out before the response that references them */
+        submit_pushes(session, stream);
         rv = submit_response(session, stream->response);
     }
     else {
@@ -1168,8 +1547,10 @@ void h2_session_log_stats(h2_session *session)
 {
     assert(session);
     ap_log_cerror(APLOG_MARK, APLOG_INFO, 0, session->c,
-                  "h2_session(%ld): %ld open streams",
-                  session->id, h2_stream_set_size(session->streams));
+                  "h2_session(%ld): %ld open streams, %ld processed inline, "
+                  "%ld collapsed",
+                  session->id, h2_stream_set_size(session->streams),
+                  (long)session->inline_count, (long)session->collapsed_count);
     h2_stream_set_iter(session->streams, log_stream, session);
 }
 
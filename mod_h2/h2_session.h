@@ -41,10 +41,12 @@ struct apr_thread_mutext_t;
 struct apr_thread_cond_t;
 struct h2_config;
 struct h2_mplx;
+struct h2_pool_cache;
 struct h2_response;
 struct h2_session;
 struct h2_stream;
 struct h2_task;
+struct h2_worker;
 
 struct nghttp2_session;
 
@@ -86,6 +88,29 @@ struct h2_session {
     struct h2_mplx *mplx;           /* multiplexer for stream data */
     struct h2_stream_set *streams;  /* streams handled by this session */
     struct h2_stream_set *zombies;  /* streams that are done */
+    struct h2_pool_cache *stream_pools; /* cleared pools for new streams */
+    
+    apr_interval_time_t idle_shed_timeout; /* idle time before shedding */
+    int shed;                       /* idle, stream state given up */
+    int hpack_inflate_size;         /* HPACK table size we announce */
+    
+    int push_enabled;               /* push resources from link headers */
+    struct h2_push_diary *push_diary; /* resources the client has */
+    
+    apr_size_t defer_body_max;      /* request bodies up to this size are
+                                     * received before the task starts */
+    apr_size_t deferred_len;        /* body bytes held for deferred tasks */
+    
+    apr_off_t hd_in_raw;            /* request header bytes, uncompressed */
+    apr_off_t hd_in_encoded;        /* request header bytes, HPACK encoded */
+    apr_off_t hd_out_raw;           /* response header bytes, uncompressed */
+    apr_off_t hd_out_encoded;       /* response header bytes, HPACK encoded */
+    
+    apr_array_header_t *inline_locations; /* paths run on this thread */
+    struct h2_worker *inline_worker; /* runs tasks on this thread */
+    apr_size_t inline_count;        /* # of tasks run on this thread */
+    apr_array_header_t *collapse_locations; /* paths collapsing identical GETs */
+    apr_size_t collapsed_count;     /* # of streams answered by another's task */
     
     after_stream_open *after_stream_opened_cb; /* stream task can start */
     before_stream_close *before_stream_close_cb; /* stream will close */
@@ -27,6 +27,8 @@
 
 #include "h2_private.h"
 #include "h2_bucket.h"
+#include "h2_cache.h"
+#include "h2_flight.h"
 #include "h2_mplx.h"
 #include "h2_request.h"
 #include "h2_response.h"
@@ -47,12 +49,12 @@ static void set_state(h2_stream *stream, h2_stream_state_t state)
     }
 }
 
-h2_stream *h2_stream_create(int id, apr_pool_t *master, 
+h2_stream *h2_stream_create(int id, h2_pool_cache *pools, 
                             apr_bucket_alloc_t *bucket_alloc, 
                             struct h2_mplx *m)
 {
     apr_pool_t *spool = NULL;
-    apr_status_t status = apr_pool_create(&spool, master);
+    apr_status_t status = h2_pool_cache_get(pools, &spool);
     if (status != APR_SUCCESS) {
         return NULL;
     }
@@ -62,6 +64,7 @@ h2_stream *h2_stream_create(int id, apr_pool_t *master,
         stream->id = id;
         stream->state = H2_STREAM_ST_IDLE;
         stream->pool = spool;
+        stream->pools = pools;
         stream->bucket_alloc = bucket_alloc;
         stream->m = m;
         stream->request = h2_request_create(id, spool, m);
@@ -79,18 +82,35 @@ apr_status_t h2_stream_destroy(h2_stream *stream)
                   "h2_stream(%ld-%d): destroy",
                   h2_mplx_get_id(stream->m), stream->id);
     h2_request_destroy(stream->request);
+    if (stream->flight) {
+        if (stream->flight_leader) {
+            /* no task took over */
+            h2_flight_end(stream->flight);
+        }
+        else {
+            h2_flight_leave(stream->flight, stream->m, stream->id);
+        }
+        stream->flight = NULL;
+    }
+    if (stream->bbout) {
+        /* FILE buckets may read files of the io's pool */
+        apr_brigade_cleanup(stream->bbout);
+        stream->bbout = NULL;
+    }
     h2_mplx_close_io(stream->m, stream->id);
     stream->m = NULL;
     if (stream->task) {
         h2_task_destroy(stream->task);
         stream->task = NULL;
     }
-    if (stream->bbout) {
-        apr_brigade_cleanup(stream->bbout);
-        stream->bbout = NULL;
+    if (stream->cache_entry) {
+        /* the body buckets referencing the entry are gone now */
+        h2_cache_release(stream->cache_entry);
+        stream->cache_entry = NULL;
     }
     if (stream->pool) {
-        apr_pool_destroy(stream->pool);
+        /* stream and task live in the pool, clearing it ends them */
+        h2_pool_cache_put(stream->pools, stream->pool);
     }
     return APR_SUCCESS;
 }
@@ -112,21 +132,84 @@ apr_status_t h2_stream_set_response(h2_stream *stream,
                                     apr_bucket_brigade *bb)
 {
     stream->response = response;
+    stream->cache_fill = h2_cache_fill_create(stream->request, response,
+                                              stream->pool);
     if (bb) {
         if (stream->bbout == NULL) {
             stream->bbout = apr_brigade_create(stream->pool, 
                                                stream->bucket_alloc);
         }
+        /* scanned once here, counted from then on */
+        apr_off_t len = 0;
+        apr_status_t status = apr_brigade_length(bb, 1, &len);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        stream->bbout_len += len;
         return h2_util_pass(stream->bbout, bb, 0);
     }
     return APR_SUCCESS;
 }
 
+apr_status_t h2_stream_serve_cached(h2_stream *stream)
+{
+    h2_cache_entry *entry = h2_cache_lookup(stream->request);
+    if (!entry) {
+        return APR_NOTFOUND;
+    }
+    
+    if (stream->bbout == NULL) {
+        stream->bbout = apr_brigade_create(stream->pool, 
+                                           stream->bucket_alloc);
+    }
+    h2_response *response = NULL;
+    apr_status_t status = h2_cache_serve(entry, stream->request, stream->id,
+                                         stream->pool, stream->bbout, 
+                                         &response);
+    if (status != APR_SUCCESS) {
+        h2_cache_release(entry);
+        return status;
+    }
+    stream->cache_entry = entry;
+    stream->response = response;
+    apr_brigade_length(stream->bbout, 1, &stream->bbout_len);
+    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, h2_mplx_get_conn(stream->m),
+                  "h2_stream(%ld-%d): cached response %s for %s",
+                  h2_mplx_get_id(stream->m), stream->id,
+                  response->http_status, stream->request->path);
+    return APR_SUCCESS;
+}
+
+apr_status_t h2_stream_join_flight(h2_stream *stream)
+{
+    int leader = 0;
+    stream->flight = h2_flight_join(stream->request, stream->m, stream->id,
+                                    &leader);
+    if (!stream->flight) {
+        return APR_NOTFOUND;
+    }
+    stream->flight_leader = leader;
+    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, h2_mplx_get_conn(stream->m),
+                  "h2_stream(%ld-%d): %s flight for %s",
+                  h2_mplx_get_id(stream->m), stream->id,
+                  leader? "leads" : "follows", stream->request->path);
+    return leader? APR_NOTFOUND : APR_SUCCESS;
+}
+
 h2_task *h2_stream_create_task(h2_stream *stream, conn_rec *master)
 {
     assert(stream);
     stream->task = h2_task_create(h2_mplx_get_id(stream->m), stream->id, 
                                   master, stream->pool, stream->m);
+    if (stream->task) {
+        stream->task->expect_continue = 
+            h2_request_expects_continue(stream->request);
+    }
+    if (stream->task && stream->flight_leader) {
+        /* the task serves the followers from now on */
+        stream->task->flight = stream->flight;
+        stream->flight = NULL;
+    }
     ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, master,
                   "h2_stream(%ld-%d): created task for %s %s (%s)",
                   h2_mplx_get_id(stream->m), stream->id,
@@ -204,11 +287,24 @@ apr_status_t h2_stream_write_data(h2_stream *stream,
     return h2_request_write_data(stream->request, data, len, stream->m);
 }
 
+static void cache_data(h2_stream *stream, const char *data, 
+                       apr_size_t len, int eos)
+{
+    if (stream->cache_fill) {
+        if (len > 0) {
+            h2_cache_fill_add(stream->cache_fill, data, len);
+        }
+        if (eos) {
+            h2_cache_fill_end(stream->cache_fill);
+            stream->cache_fill = NULL;
+        }
+    }
+}
+
 apr_status_t h2_stream_read(h2_stream *stream, char *buffer, 
                             apr_size_t *plen, int *peos)
 {
     apr_status_t status = APR_SUCCESS;
-    apr_off_t buffered_len = 0;
     apr_size_t avail = *plen;
     apr_size_t written = 0;
     
@@ -218,26 +314,25 @@ apr_status_t h2_stream_read(h2_stream *stream, char *buffer,
                                            stream->bucket_alloc);
     }
     
-    status = apr_brigade_length(stream->bbout, 1, &buffered_len);
-    if (status != APR_SUCCESS) {
-        return status;
-    }
-    
-    if (buffered_len < avail) {
+    if (stream->bbout_len < avail && !stream->cache_entry) {
         /* Our brigade does not hold enough bytes, try to get more data.
+         * A cached response has all of it already.
          */
         ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, 
                       h2_mplx_get_conn(stream->m),
                       "h2_stream(%ld-%d): reading from mplx",
                       h2_mplx_get_id(stream->m), stream->id);
-        status = h2_mplx_out_read(stream->m, stream->id, stream->bbout, 0);
+        apr_off_t moved = 0;
+        status = h2_mplx_out_read(stream->m, stream->id, stream->bbout, 
+                                  avail - stream->bbout_len, &moved);
+        stream->bbout_len += moved;
         if (status == APR_SUCCESS) {
             /* nop */
-            apr_brigade_length(stream->bbout, 1, &buffered_len);
         }
         else if (status == APR_EOF) {
             *peos = 1;
             if (APR_BRIGADE_EMPTY(stream->bbout)) {
+                cache_data(stream, NULL, 0, 1);
                 return status;
             }
             status = APR_SUCCESS;
@@ -247,7 +342,7 @@ apr_status_t h2_stream_read(h2_stream *stream, char *buffer,
         }
     }
     
-    if (avail > 8192 && !*peos && buffered_len < 128) {
+    if (avail > 8192 && !*peos && stream->bbout_len < 128) {
         /* We have only few bytes, but could send many. If there
          * is no flush or EOS in the buffered brigade, tell the
          * caller to try again later.
@@ -277,7 +372,7 @@ apr_status_t h2_stream_read(h2_stream *stream, char *buffer,
             const char *data;
             apr_size_t data_len;
             if (APR_BUCKET_IS_FILE(b)) {
-                ap_log_cerror(APLOG_MARK, APLOG_INFO, 0, 
+                ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, 
                               h2_mplx_get_conn(stream->m),
                               "h2_stream(%ld-%d): reading FILE(%ld-%ld)",
                               h2_mplx_get_id(stream->m), stream->id,
@@ -294,6 +389,7 @@ apr_status_t h2_stream_read(h2_stream *stream, char *buffer,
                     data_len = avail;
                 }
                 memcpy(buffer, data, data_len);
+                stream->bbout_len -= data_len;
                 avail -= data_len;
                 buffer += data_len;
                 written += data_len;
@@ -310,6 +406,7 @@ apr_status_t h2_stream_read(h2_stream *stream, char *buffer,
                       (long)*plen, (long)written);
     }
     
+    cache_data(stream, buffer - written, written, *peos);
     *plen = written;
     return status;
 }
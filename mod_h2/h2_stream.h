@@ -19,8 +19,8 @@
 /**
  * A HTTP/2 stream, e.g. a client request+response in HTTP/1.1 terms.
  * 
- * Ok, not quite, but close enough, since we do not implement server
- * pushes yet.
+ * Ok, not quite, but close enough. Streams pushed by us carry a request
+ * made up from the PUSH_PROMISE and are processed the same way.
  *
  * A stream always belongs to a h2_session, the one managing the
  * connection to the client. The h2_session writes to the h2_stream,
@@ -46,6 +46,9 @@ typedef enum {
 } h2_stream_state_t;
 
 struct h2_bucket;
+struct h2_cache_entry;
+struct h2_cache_fill;
+struct h2_flight;
 struct h2_mplx;
 struct h2_request;
 struct h2_response;
@@ -62,16 +65,31 @@ struct h2_stream {
     int suspended;              /* DATA sending has been suspended */
     
     apr_pool_t *pool;           /* the memory pool for this stream */
+    struct h2_pool_cache *pools; /* where the pool goes back to */
     apr_bucket_alloc_t *bucket_alloc;
     h2_request *request;        /* the request made in this stream */
     
+    int task_deferred;          /* task waits for complete request body */
+    apr_size_t deferred_len;    /* body bytes received while deferred */
+    
     struct h2_task *task;       /* task created for this stream */
     struct h2_response *response; /* the response, once ready */
     apr_bucket_brigade *bbout;  /* output DATA */
+    apr_off_t bbout_len;        /* DATA bytes in bbout */
+    
+    struct h2_cache_entry *cache_entry; /* cached response served */
+    struct h2_cache_fill *cache_fill;   /* collects DATA for the cache */
+    
+    struct h2_flight *flight;   /* collapsed request, until a task leads it */
+    int flight_leader;          /* stream leads the flight, not follows */
 };
 
 
-h2_stream *h2_stream_create(int id, apr_pool_t *master, 
+/**
+ * Create a stream in a pool from the cache. The stream's task lives
+ * in the same pool and is recycled with it.
+ */
+h2_stream *h2_stream_create(int id, struct h2_pool_cache *pools, 
                             apr_bucket_alloc_t *bucket_alloc, 
                             struct h2_mplx *m);
 
@@ -100,6 +118,16 @@ apr_status_t h2_stream_set_response(h2_stream *stream,
                                     struct h2_response *response,
                                     apr_bucket_brigade *bb);
 
+/* Answer the request from the response cache, if it holds a fresh
+ * response for it. Returns APR_SUCCESS when the stream has its response
+ * and all DATA, APR_NOTFOUND when a task needs to handle the request. */
+apr_status_t h2_stream_serve_cached(h2_stream *stream);
+
+/* Collapse the request with identical ones in flight. Returns APR_SUCCESS
+ * when the stream follows another one and will get its output from that
+ * stream's task, APR_NOTFOUND when it needs a task of its own. */
+apr_status_t h2_stream_join_flight(h2_stream *stream);
+
 apr_status_t h2_stream_read(h2_stream *stream, char *buffer, 
                             apr_size_t *plen, int *peos);
 
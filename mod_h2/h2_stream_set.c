@@ -31,6 +31,9 @@
 
 #define H2_STREAM_IDX(list, i) ((h2_stream**)(list)->elts)[i]
 
+/* grows as needed, idle sessions keep the initial size */
+#define H2_SET_INIT_SIZE    16
+
 struct h2_stream_set {
     apr_array_header_t *list;
 };
@@ -39,7 +42,7 @@ h2_stream_set *h2_stream_set_create(apr_pool_t *pool)
 {
     h2_stream_set *sp = apr_pcalloc(pool, sizeof(h2_stream_set));
     if (sp) {
-        sp->list = apr_array_make(pool, 100, sizeof(h2_stream*));
+        sp->list = apr_array_make(pool, H2_SET_INIT_SIZE, sizeof(h2_stream*));
         if (!sp->list) {
             return NULL;
         }
@@ -28,6 +28,7 @@
 #include "h2_private.h"
 #include "h2_bucket.h"
 #include "h2_conn.h"
+#include "h2_flight.h"
 #include "h2_from_h1.h"
 #include "h2_mplx.h"
 #include "h2_session.h"
@@ -49,6 +50,13 @@ static apr_status_t h2_filter_stream_input(ap_filter_t* filter,
     if (!task->input) {
         return APR_ECONNABORTED;
     }
+    if (block == APR_BLOCK_READ && task->output) {
+        /* the handler may wait a while, do not hold its output */
+        apr_status_t status = h2_task_output_flush(task->output);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+    }
     return h2_task_input_read(task->input, filter, brigade,
                               mode, block, readbytes);
 }
@@ -73,6 +81,26 @@ static apr_status_t h2_filter_read_response(ap_filter_t* f,
     return h2_from_h1_read_response(task->output->from_h1, f, bb);
 }
 
+static apr_status_t h2_filter_continue(ap_filter_t* f,
+                                      apr_bucket_brigade* bb,
+                                      ap_input_mode_t mode,
+                                      apr_read_type_e block,
+                                      apr_off_t readbytes) {
+    h2_task *task = (h2_task *)f->ctx;
+    request_rec *r = f->r;
+    assert(task);
+    /* The handler asks for the request body for the first time. Unless
+     * it already decided on the response, let the client go ahead. */
+    if (!r->eos_sent && !r->bytes_sent && !ap_is_HTTP_ERROR(r->status)) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r,
+                      "h2_task(%s): body read, sending 100-continue",
+                      task->id);
+        h2_mplx_out_continue(task->mplx, task->stream_id);
+    }
+    ap_remove_input_filter(f);
+    return ap_get_brigade(f->next, bb, mode, block, readbytes);
+}
+
 void h2_task_register_hooks(void)
 {
     ap_register_input_filter("H2_TO_H1", h2_filter_stream_input,
@@ -81,6 +109,8 @@ void h2_task_register_hooks(void)
                               NULL, AP_FTYPE_NETWORK);
     ap_register_output_filter("H1_TO_H2_RESP", h2_filter_read_response,
                               NULL, AP_FTYPE_PROTOCOL);
+    ap_register_input_filter("H2_CONTINUE", h2_filter_continue,
+                             NULL, AP_FTYPE_RESOURCE);
 }
 
 int h2_task_pre_conn(h2_task *task, conn_rec *c)
@@ -147,6 +177,11 @@ apr_status_t h2_task_destroy(h2_task *task)
     assert(task);
     ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, h2_mplx_get_conn(task->mplx),
                   "h2_task(%s): destroy started", task->id);
+    if (task->flight) {
+        /* never ran, the followers need to know */
+        h2_flight_end(task->flight);
+        task->flight = NULL;
+    }
     if (task->mplx) {
         task->mplx = NULL;
     }
@@ -157,12 +192,6 @@ apr_status_t h2_task_destroy(h2_task *task)
     return APR_SUCCESS;
 }
 
-void h2_task_on_finished(h2_task *task, task_callback *cb, void *cb_ctx)
-{
-    task->on_finished = cb;
-    task->ctx_finished = cb_ctx;
-}
-
 apr_status_t h2_task_do(h2_task *task, h2_worker *worker)
 {
     apr_status_t status = APR_SUCCESS;
@@ -190,9 +219,9 @@ apr_status_t h2_task_do(h2_task *task, h2_worker *worker)
          * other hooks from messing with it. */
         h2_ctx_create_for(task->conn->c, task);
         /* borrow the condition from the worker during our processing. we
-         * will use it for io blocking and signalling. */
+         * will use it for io blocking and signalling. Inline workers have
+         * none, tasks run on them never wait for io. */
         task->io = h2_worker_get_cond(worker);
-        assert(task->io);
         
         status = h2_conn_process(task->conn);
         
@@ -203,10 +232,6 @@ apr_status_t h2_task_do(h2_task *task, h2_worker *worker)
         h2_task_output_close(task->output);
     }
     
-    if (task->on_finished) {
-        task->on_finished(task->ctx_finished, task);
-    }
-
     if (task->input) {
         h2_task_input_destroy(task->input);
         task->input = NULL;
@@ -37,6 +37,7 @@
 
 struct apr_thread_cond_t;
 struct h2_conn;
+struct h2_flight;
 struct h2_mplx;
 struct h2_task;
 struct h2_resp_head;
@@ -45,8 +46,6 @@ struct h2_worker;
 
 typedef struct h2_task h2_task;
 
-typedef void task_callback(void *ctx, h2_task *task);
-
 struct h2_task {
     const char *id;
     int stream_id;
@@ -62,9 +61,8 @@ struct h2_task {
     struct h2_task_input *input;    /* http/1.1 input data */
     struct h2_task_output *output;  /* response body data */
     struct apr_thread_cond_t *io;   /* optional condition to wait for io on */
-    
-    task_callback *on_finished;
-    void *ctx_finished;
+    struct h2_flight *flight;       /* collapsed requests led by this task */
+    int expect_continue;            /* client waits for 100 before body */
 };
 
 
@@ -89,8 +87,6 @@ void h2_task_set_started(h2_task *task, int started);
 int h2_task_has_finished(h2_task *task);
 void h2_task_set_finished(h2_task *task, int finished);
 
-void h2_task_on_finished(h2_task *task, task_callback *cb, void *cb_ctx);
-
 const char *h2_task_get_id(h2_task *task);
 
 void h2_task_register_hooks(void);
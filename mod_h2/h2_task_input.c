@@ -34,7 +34,7 @@ struct h2_task_input {
     struct h2_mplx *m;
     
     int eos;
-    struct h2_bucket *cur;
+    apr_bucket_brigade *bb;
 };
 
 
@@ -43,23 +43,6 @@ static int is_aborted(h2_task_input *input, ap_filter_t *f)
     return (f->c->aborted || h2_task_is_aborted(input->task));
 }
 
-/** stream is in state of input closed. That means no input is pending
- * on the connection and all input (if any) is in the input queue.
- */
-static int all_queued(h2_task_input *input)
-{
-    return input->eos || h2_mplx_in_has_eos_for(input->m, input->stream_id);
-}
-
-static void cleanup(h2_task_input *input) {
-    if (input->cur) {
-        /* we read all in a previous call, time to remove
-         * this bucket. */
-        h2_bucket_destroy(input->cur);
-        input->cur = NULL;
-    }
-}
-
 h2_task_input *h2_task_input_create(apr_pool_t *pool, h2_task *task, 
                                     int stream_id, h2_mplx *m)
 {
@@ -74,12 +57,57 @@ h2_task_input *h2_task_input_create(apr_pool_t *pool, h2_task *task,
 
 void h2_task_input_destroy(h2_task_input *input)
 {
-    if (input->cur) {
-        h2_bucket_destroy(input->cur);
-        input->cur = NULL;
+    if (input->bb) {
+        apr_brigade_destroy(input->bb);
+        input->bb = NULL;
     }
 }
 
+/* Move buckets holding up to len bytes from one brigade to the other. */
+static apr_status_t move_bytes(apr_bucket_brigade *to, 
+                               apr_bucket_brigade *from, apr_off_t len)
+{
+    apr_bucket *end;
+    apr_status_t status = apr_brigade_partition(from, len, &end);
+    if (status == APR_SUCCESS || status == APR_INCOMPLETE) {
+        while (!APR_BRIGADE_EMPTY(from) && APR_BRIGADE_FIRST(from) != end) {
+            apr_bucket *b = APR_BRIGADE_FIRST(from);
+            APR_BUCKET_REMOVE(b);
+            APR_BRIGADE_INSERT_TAIL(to, b);
+        }
+        status = APR_SUCCESS;
+    }
+    return status;
+}
+
+/* Copy buckets holding up to len bytes from one brigade to the other. The
+ * copies share the data with the originals. */
+static apr_status_t copy_bytes(apr_bucket_brigade *to, 
+                               apr_bucket_brigade *from, apr_off_t len)
+{
+    apr_status_t status = APR_SUCCESS;
+    apr_bucket *b;
+    
+    for (b = APR_BRIGADE_FIRST(from); 
+         len > 0 && b != APR_BRIGADE_SENTINEL(from)
+         && status == APR_SUCCESS;
+         b = APR_BUCKET_NEXT(b)) {
+        apr_bucket *c;
+        status = apr_bucket_copy(b, &c);
+        if (status == APR_SUCCESS) {
+            /* link the copy into its brigade before splitting it, the
+             * copy still carries the ring links of the original. */
+            APR_BRIGADE_INSERT_TAIL(to, c);
+            if (c->length > len) {
+                apr_bucket_split(c, len);
+                apr_bucket_delete(APR_BUCKET_NEXT(c));
+            }
+            len -= c->length;
+        }
+    }
+    return status;
+}
+
 apr_status_t h2_task_input_read(h2_task_input *input,
                                 ap_filter_t* filter,
                                 apr_bucket_brigade* brigade,
@@ -88,85 +116,43 @@ apr_status_t h2_task_input_read(h2_task_input *input,
                                 apr_off_t readbytes)
 {
     apr_status_t status = APR_SUCCESS;
-    apr_size_t nread = 0;
 
     if (is_aborted(input, filter)) {
         return APR_ECONNABORTED;
     }
     
-    if (input->cur && input->cur->data_len <= 0) {
-        cleanup(input);
+    if (!input->bb) {
+        input->bb = apr_brigade_create(filter->c->pool, 
+                                       filter->c->bucket_alloc);
     }
     
-    if (!input->eos && !input->cur) {
+    if (!input->eos && APR_BRIGADE_EMPTY(input->bb)) {
         /* Try to get new data for our stream from the queue.
-         * If all data is in queue (could be none), do not block.
-         * Getting none back in that case means we reached the
-         * end of the input.
+         * The h2_bucket we get is handed on to the brigade without
+         * copying its data, the apr_bucket now owns it.
          */
+        struct h2_bucket *cur = NULL;
         status = h2_mplx_in_read(input->m, block,
-                                 input->stream_id, &input->cur, 
+                                 input->stream_id, &cur, 
                                  h2_task_get_io_cond(input->task));
         ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, filter->c,
                       "h2_task_input(%s): mplx returned %ld bytes",
                       h2_task_get_id(input->task), 
-                      (long)(input->cur? input->cur->data_len : -1L));
+                      (long)(cur? cur->data_len : -1L));
         if (status == APR_EOF) {
             input->eos = 1;
         }
-    }
-    
-    if (is_aborted(input, filter)) {
-        return APR_ECONNABORTED;
-    }
-    
-    if (input->eos) {
-        ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, filter->c,
-                      "h2_task_input(%s): read returns EOF",
-                      h2_task_get_id(input->task));
-        cleanup(input);
-        return APR_EOF;
-    }
-    
-    if (input->cur) {
-        /* Got data, depends on the read mode how much we return. */
-        h2_bucket *b = input->cur;
-        apr_size_t avail = b->data_len;
-        if (avail > 0) {
-            if (mode == AP_MODE_EXHAUSTIVE) {
-                /* return all we have */
-                nread = avail;
-            }
-            else if (mode == AP_MODE_READBYTES
-                     || mode == AP_MODE_SPECULATIVE) {
-                /* return not more than was asked for */
-                nread = (avail > readbytes)? readbytes : avail;
-            }
-            else if (mode == AP_MODE_GETLINE) {
-                /* Look for a linebreak in the first GetLineMax bytes.
-                 * If we do not find one, return all we have. */
-                apr_size_t scan = 0;
-                apr_size_t scan_max = ((b->data_len > 4096)?
-                                       4096 : b->data_len);
-                apr_off_t index = -1;
-                for (/**/; scan < scan_max; ++scan) {
-                    if (b->data[scan] == '\n') {
-                        index = scan;
-                        break;
-                    }
-                }
-                
-                nread = (index >= 0)? (index + 1) : avail;
+        else if (status == APR_SUCCESS && cur) {
+            if (cur->data_len > 0) {
+                APR_BRIGADE_INSERT_TAIL(input->bb, 
+                    h2_bucket_to_apr_bucket(cur, input->bb->bucket_alloc));
             }
             else {
-                /* Hmm, well. There is mode AP_MODE_EATCRLF, but we chose not
-                 * to support it. Seems to work. */
-                ap_log_cerror(APLOG_MARK, APLOG_ERR, APR_ENOTIMPL, filter->c,
-                              "h2_task_input, unsupported READ mode %d",
-                              mode);
-                return APR_ENOTIMPL;
+                h2_bucket_destroy(cur);
             }
-            
+        }
+        else if (status != APR_EAGAIN) {
+            return status;
         }
     }
     
@@ -174,24 +160,46 @@ apr_status_t h2_task_input_read(h2_task_input *input,
         return APR_ECONNABORTED;
     }
     
-    if (nread > 0) {
-        /* We got actual data. */
-        apr_bucket *b = apr_bucket_transient_create(input->cur->data, nread, 
-                                                    brigade->bucket_alloc);
-        APR_BRIGADE_INSERT_TAIL(brigade, b);
-        if (mode != AP_MODE_SPECULATIVE) {
-            h2_bucket_consume(input->cur, nread);
-            ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, filter->c,
-                          "h2_task_input(%s): forward %d bytes",
-                          h2_task_get_id(input->task), (int)nread);
+    if (APR_BRIGADE_EMPTY(input->bb)) {
+        if (input->eos) {
+            ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, filter->c,
+                          "h2_task_input(%s): read returns EOF",
+                          h2_task_get_id(input->task));
+            return APR_EOF;
         }
+        /* no EOS, no data. Caller may try again. */
+        return (block == APR_NONBLOCK_READ)? APR_EAGAIN : APR_SUCCESS;
     }
     
-    if (nread == 0 && !input->eos && block == APR_NONBLOCK_READ) {
-        /* no EOS, no data and call was non blocking. Caller may try again. */
-        return APR_EAGAIN;
+    /* Got data, depends on the read mode how much we return. */
+    switch (mode) {
+        case AP_MODE_EXHAUSTIVE:
+            /* return all we have */
+            APR_BRIGADE_CONCAT(brigade, input->bb);
+            break;
+        case AP_MODE_READBYTES:
+            /* return not more than was asked for */
+            status = move_bytes(brigade, input->bb, readbytes);
+            break;
+        case AP_MODE_SPECULATIVE:
+            status = copy_bytes(brigade, input->bb, readbytes);
+            break;
+        case AP_MODE_GETLINE:
+            /* Look for a linebreak in the first GetLineMax bytes.
+             * If we do not find one, return all we have. */
+            status = apr_brigade_split_line(brigade, input->bb, block, 4096);
+            break;
+        default:
+            /* Hmm, well. There is mode AP_MODE_EATCRLF, but we chose not
+             * to support it. Seems to work. */
+            ap_log_cerror(APLOG_MARK, APLOG_ERR, APR_ENOTIMPL, filter->c,
+                          "h2_task_input, unsupported READ mode %d",
+                          mode);
+            return APR_ENOTIMPL;
     }
     
-    return APR_SUCCESS;
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE2, status, filter->c,
+                  "h2_task_input(%s): forwarded data in mode %d",
+                  h2_task_get_id(input->task), mode);
+    return status;
 }
-
@@ -15,14 +15,18 @@
 
 #include <assert.h>
 
+#include <apr_strings.h>
+
 #include <httpd.h>
 #include <http_core.h>
 #include <http_log.h>
 #include <http_connection.h>
 
 #include "h2_private.h"
+#include "h2_config.h"
 #include "h2_bucket.h"
 #include "h2_conn.h"
+#include "h2_flight.h"
 #include "h2_mplx.h"
 #include "h2_session.h"
 #include "h2_stream.h"
@@ -52,6 +56,13 @@ h2_task_output *h2_task_output_create(apr_pool_t *pool,
         output->stream_id = stream_id;
         output->m = m;
         output->state = H2_TASK_OUT_INIT;
+        
+        h2_config *conf = h2_config_get(task->master);
+        output->flush_size = h2_config_geti(conf, H2_CONF_STREAM_FLUSH_SIZE);
+        output->flush_interval = apr_time_from_msec(
+            h2_config_geti(conf, H2_CONF_STREAM_FLUSH_MSECS));
+        output->spool_max = h2_config_geti(conf, 
+                                           H2_CONF_STREAM_MAX_SPOOL_SIZE);
         output->from_h1 = h2_from_h1_create(stream_id, pool, bucket_alloc);
         if (!output->from_h1) {
             return NULL;
@@ -74,6 +85,10 @@ void h2_task_output_close(h2_task_output *output)
     if (output->state != H2_TASK_OUT_DONE) {
         h2_mplx_out_close(output->m, output->stream_id);
         output->state = H2_TASK_OUT_DONE;
+        if (output->task->flight) {
+            h2_flight_end(output->task->flight);
+            output->task->flight = NULL;
+        }
     }
 }
 
@@ -82,9 +97,54 @@ int h2_task_output_has_started(h2_task_output *output)
     return output->state >= H2_TASK_OUT_STARTED;
 }
 
-static apr_status_t out_write(h2_task_output *output, ap_filter_t *f,
+/* Write the data at the head of the brigade to the spool, up to the
+ * first metadata bucket or the spool's limit, and have the mplx queue
+ * it. The writing happens without holding the mplx lock. */
+static apr_status_t spool_out(h2_task_output *output, ap_filter_t *f,
                               apr_bucket_brigade *bb)
 {
+    apr_status_t status = APR_SUCCESS;
+    if (!output->spool) {
+        status = h2_util_spool_create(&output->spool, &output->spool_in, 
+                                      f->c->pool);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+    }
+    
+    apr_off_t len = 0;
+    if (output->spool_len < output->spool_max) {
+        status = h2_util_spool_write(output->spool, bb, 
+                                     output->spool_max - output->spool_len,
+                                     &len);
+    }
+    if (len > 0) {
+        apr_status_t qstatus = h2_mplx_out_spooled(output->m, 
+                                                   output->stream_id,
+                                                   &output->spool_in, 
+                                                   output->spool_len, len);
+        output->spool_len += len;
+        if (status == APR_SUCCESS) {
+            status = qstatus;
+        }
+    }
+    else if (status == APR_SUCCESS) {
+        /* nothing more fits, the mplx has to wait for its client */
+        status = APR_ENOSPC;
+    }
+    return status;
+}
+
+/* Output is copied into malloc'ed chunks on our thread, so that the 
+ * mplx only has to take over their memory while holding its lock. 
+ * One chunk is about the most a DATA frame carries. */
+#define H2_OUT_CHUNK_SIZE       (16 * 1024)
+
+static apr_status_t out_write_chunk(h2_task_output *output, ap_filter_t *f,
+                                    apr_bucket_brigade *bb)
+{
+    apr_status_t status;
+    output->last_out = apr_time_now();
     if (output->state == H2_TASK_OUT_INIT) {
         output->state = H2_TASK_OUT_STARTED;
         h2_response *response = h2_from_h1_get_response(output->from_h1);
@@ -96,12 +156,99 @@ static apr_status_t out_write(h2_task_output *output, ap_filter_t *f,
             return APR_ECONNABORTED;
         }
         
-        return h2_mplx_out_open(output->m, output->stream_id, 
-                                response, f, bb,
-                                h2_task_get_io_cond(output->task));
+        if (output->task->flight) {
+            /* followers get their copy before the mplx takes the buckets */
+            h2_flight_out(output->task->flight, response, f, bb);
+        }
+        status = h2_mplx_out_open(output->m, output->stream_id, 
+                                  response, f, bb,
+                                  h2_task_get_io_cond(output->task));
+    }
+    else {
+        if (output->task->flight) {
+            h2_flight_out(output->task->flight, NULL, f, bb);
+        }
+        status = h2_mplx_out_write(output->m, output->stream_id, f, bb,
+                                   h2_task_get_io_cond(output->task));
+    }
+    while (status == APR_INCOMPLETE) {
+        /* the client is slow, spool what does not fit into memory */
+        status = spool_out(output, f, bb);
+        if (status == APR_SUCCESS) {
+            status = h2_mplx_out_write(output->m, output->stream_id, f, bb,
+                                       h2_task_get_io_cond(output->task));
+        }
+    }
+    return status;
+}
+
+/* Output of unknown length is made movable one chunk at a time, which
+ * the mplx takes within the stream's budget before we read on. */
+static apr_status_t out_write(h2_task_output *output, ap_filter_t *f,
+                              apr_bucket_brigade *bb)
+{
+    apr_status_t status = APR_SUCCESS;
+    if (!output->chunk) {
+        output->chunk = apr_brigade_create(bb->p, bb->bucket_alloc);
+    }
+    do {
+        status = h2_util_make_movable(output->chunk, bb, H2_OUT_CHUNK_SIZE);
+        if (status == APR_SUCCESS) {
+            status = out_write_chunk(output, f, output->chunk);
+        }
+        apr_brigade_cleanup(output->chunk);
+    } while (status == APR_SUCCESS && !APR_BRIGADE_EMPTY(bb));
+    return status;
+}
+
+/* Handlers streaming their output rarely flush. Pass on what is held
+ * when the first body bytes arrive, so the response headers go out
+ * right away, and afterwards when enough has piled up or has been
+ * held for too long. Output of unknown length, e.g. from a pipe, is 
+ * passed on at once, since reading it may block. Time is looked at 
+ * when more output comes, a handler waiting for its input has its
+ * output flushed first, see h2_task_output_flush(). Handlers waiting
+ * on other things, e.g. a proxy on its backend, flush themselves.
+ */
+static int should_flush(h2_task_output *output)
+{
+    if (output->state == H2_TASK_OUT_INIT || output->held < 0) {
+        return 1;
+    }
+    if (output->flush_size > 0 && output->held >= output->flush_size) {
+        return 1;
     }
-    return h2_mplx_out_write(output->m, output->stream_id, f, bb,
-                             h2_task_get_io_cond(output->task));
+    return (output->flush_interval > 0
+            && (apr_time_now() - output->last_out) >= output->flush_interval);
+}
+
+/* The number of data bytes in the brigade, -1 if a bucket has no 
+ * length yet. Buckets are not read. */
+static apr_off_t data_length(apr_bucket_brigade *bb)
+{
+    apr_off_t len = 0;
+    for (apr_bucket *b = APR_BRIGADE_FIRST(bb);
+         b != APR_BRIGADE_SENTINEL(bb);
+         b = APR_BUCKET_NEXT(b)) {
+        if (b->length == (apr_size_t)-1) {
+            return -1;
+        }
+        if (!APR_BUCKET_IS_METADATA(b)) {
+            len += b->length;
+        }
+    }
+    return len;
+}
+
+apr_status_t h2_task_output_flush(h2_task_output *output)
+{
+    apr_status_t status = APR_SUCCESS;
+    if (output->bb && !APR_BRIGADE_EMPTY(output->bb)) {
+        status = out_write(output, output->f, output->bb);
+        apr_brigade_cleanup(output->bb);
+        output->held = 0;
+    }
+    return status;
 }
 
 /* Bring the data from the brigade (which represents the result of the
@@ -119,9 +266,11 @@ apr_status_t h2_task_output_write(h2_task_output *output,
     
     if (h2_util_has_flush_or_eos(bb)) {
         if (output->bb && !APR_BRIGADE_EMPTY(output->bb)) {
-            status = h2_util_move(output->bb, bb, 0, "task_output_write1");
+            status = h2_util_move(output->bb, bb, 0, NULL, NULL,
+                                  "task_output_write1");
             status = out_write(output, f, output->bb);
             apr_brigade_cleanup(output->bb);
+            output->held = 0;
         }
         else {
             status = out_write(output, f, bb);
@@ -131,7 +280,14 @@ apr_status_t h2_task_output_write(h2_task_output *output,
         if (!output->bb) {
             output->bb = apr_brigade_create(bb->p, bb->bucket_alloc);
         }
-        status = h2_util_move(output->bb, bb, 0, "task_output_write2");
+        apr_off_t len = data_length(bb);
+        output->held = (len < 0 || output->held < 0)? -1 : output->held + len;
+        output->f = f;
+        status = h2_util_move(output->bb, bb, 0, NULL, NULL,
+                              "task_output_write2");
+        if (status == APR_SUCCESS && should_flush(output)) {
+            status = h2_task_output_flush(output);
+        }
     }
     return status;
 }
@@ -42,7 +42,18 @@ struct h2_task_output {
     struct h2_mplx *m;
     struct h2_from_h1 *from_h1;
     
-    apr_bucket_brigade *bb;
+    apr_bucket_brigade *bb;         /* output held until a flush */
+    apr_bucket_brigade *chunk;      /* output made movable for the mplx */
+    ap_filter_t *f;                 /* the filter output was held for */
+    apr_off_t held;                 /* bytes in bb, -1 if unknown */
+    apr_off_t flush_size;           /* pass on once this much is held */
+    apr_interval_time_t flush_interval; /* max time output is held */
+    apr_time_t last_out;            /* when output was last passed on */
+    
+    apr_file_t *spool;              /* output the client is too slow for */
+    apr_file_t *spool_in;           /* read handle, until the mplx has it */
+    apr_off_t spool_len;            /* bytes written to the spool */
+    apr_off_t spool_max;            /* max bytes spooled */
 };
 
 h2_task_output *h2_task_output_create(apr_pool_t *pool,
@@ -60,6 +71,12 @@ apr_status_t h2_task_output_write(h2_task_output *output,
                                   ap_filter_t* filter,
                                   apr_bucket_brigade* brigade);
 
+/**
+ * Pass on any output held for a later flush, e.g. before the handler 
+ * blocks reading its input.
+ */
+apr_status_t h2_task_output_flush(h2_task_output *output);
+
 void h2_task_output_close(h2_task_output *output);
 
 int h2_task_output_has_started(h2_task_output *output);
@@ -39,6 +39,7 @@ static const apr_off_t HEADERSIZE      = 16 * 1024;
 struct h2_to_h1 {
     h2_bucket *data;
     int stream_id;
+    apr_pool_t *pool;
     h2_mplx *m;
     int eoh;
     int eos;
@@ -46,6 +47,12 @@ struct h2_to_h1 {
     int seen_host;
     int chunked;
     apr_size_t remain_len;
+    apr_off_t content_length;
+    int expect_continue;
+    int cache_bypass;
+    const char *if_none_match;
+    const char *variant;
+    apr_table_t *push_headers;
 };
 
 h2_to_h1 *h2_to_h1_create(int stream_id, apr_pool_t *pool, h2_mplx *m)
@@ -53,7 +60,9 @@ h2_to_h1 *h2_to_h1_create(int stream_id, apr_pool_t *pool, h2_mplx *m)
     h2_to_h1 *to_h1 = apr_pcalloc(pool, sizeof(h2_to_h1));
     if (to_h1) {
         to_h1->stream_id = stream_id;
+        to_h1->pool = pool;
         to_h1->m = m;
+        to_h1->content_length = -1;
     }
     return to_h1;
 }
@@ -141,35 +150,97 @@ static apr_status_t append_header(h2_bucket *bucket,
     return APR_SUCCESS;
 }
 
+static void add_push_header(h2_to_h1 *to_h1, const char *name, size_t nlen,
+                            const char *value, size_t vlen)
+{
+    if (!to_h1->push_headers) {
+        to_h1->push_headers = apr_table_make(to_h1->pool, 5);
+    }
+    apr_table_addn(to_h1->push_headers, apr_pstrndup(to_h1->pool, name, nlen),
+                   apr_pstrndup(to_h1->pool, value, vlen));
+}
+
 apr_status_t h2_to_h1_add_header(h2_to_h1 *to_h1,
                                  const char *name, size_t nlen,
                                  const char *value, size_t vlen)
 {
-    if (H2_HD_MATCH_LIT("transfer-encoding", name, nlen)) {
-        if (!apr_strnatcasecmp("chunked", value)) {
-            to_h1->chunked = 1;
-        }
-    }
-    else if (H2_HD_MATCH_LIT("content-length", name, nlen)) {
-        char *end;
-        to_h1->remain_len = apr_strtoi64(value, &end, 10);
-        if (value == end) {
-            ap_log_cerror(APLOG_MARK, APLOG_WARNING, APR_EINVAL, 
-                          h2_mplx_get_conn(to_h1->m),
-                          "h2_request(%d): content-length value not parsed: %s",
-                          to_h1->stream_id, value);
-            return APR_EINVAL;
+    h2_hd_t hd = h2_util_hd_classify(name, nlen);
+    switch (hd) {
+        case H2_HD_TRANSFER_ENCODING:
+            if (!apr_strnatcasecmp("chunked", value)) {
+                to_h1->chunked = 1;
+            }
+            break;
+        case H2_HD_CONTENT_LENGTH: {
+            char *end;
+            to_h1->remain_len = apr_strtoi64(value, &end, 10);
+            if (value == end) {
+                ap_log_cerror(APLOG_MARK, APLOG_WARNING, APR_EINVAL, 
+                              h2_mplx_get_conn(to_h1->m),
+                              "h2_request(%d): content-length value not parsed: %s",
+                              to_h1->stream_id, value);
+                return APR_EINVAL;
+            }
+            to_h1->content_length = to_h1->remain_len;
+            break;
         }
-    }
-    else if ((to_h1->seen_host && H2_HD_MATCH_LIT("host", name, nlen))
-             || H2_HD_MATCH_LIT("expect", name, nlen)
-             || H2_HD_MATCH_LIT("upgrade", name, nlen)
-             || H2_HD_MATCH_LIT("connection", name, nlen)
-             || H2_HD_MATCH_LIT("proxy-connection", name, nlen)
-             || H2_HD_MATCH_LIT("keep-alive", name, nlen)
-             || H2_HD_MATCH_LIT("http2-settings", name, nlen)) {
-        // ignore these.
-        return APR_SUCCESS;
+        case H2_HD_HOST:
+            if (to_h1->seen_host) {
+                return APR_SUCCESS;
+            }
+            break;
+        case H2_HD_EXPECT:
+            /* A 100-continue is sent by us as HEADERS once the handler
+             * asks for the body. httpd must not see it, its HTTP_IN
+             * would write a HTTP/1.1 status line into the response.
+             * Other expectations are passed on, to be answered with
+             * a 417. */
+            if (h2_util_contains_token(to_h1->pool, value, "100-continue")) {
+                to_h1->expect_continue = 1;
+                return APR_SUCCESS;
+            }
+            break;
+        case H2_HD_AUTHORIZATION:
+        case H2_HD_RANGE:
+            /* never answered from or stored in the response cache */
+            to_h1->cache_bypass = 1;
+            break;
+        case H2_HD_CACHE_CONTROL:
+        case H2_HD_PRAGMA:
+            if (h2_util_contains_token(to_h1->pool, value, "no-cache")
+                || h2_util_contains_token(to_h1->pool, value, "no-store")
+                || h2_util_contains_token(to_h1->pool, value, "max-age=0")) {
+                to_h1->cache_bypass = 1;
+            }
+            break;
+        case H2_HD_IF_NONE_MATCH:
+            to_h1->if_none_match = apr_pstrndup(to_h1->pool, value, vlen);
+            break;
+        case H2_HD_ACCEPT_ENCODING:
+        case H2_HD_ACCEPT_LANGUAGE:
+        case H2_HD_COOKIE:
+            /* the client would send these for the resources we push */
+            add_push_header(to_h1, name, nlen, value, vlen);
+            /* fall through */
+        case H2_HD_ACCEPT:
+            /* the usual suspects in a Vary, identical requests need
+             * to agree on them */
+            to_h1->variant = apr_psprintf(to_h1->pool, "%s%.*s: %.*s\n",
+                                          to_h1->variant? to_h1->variant : "",
+                                          (int)nlen, name, (int)vlen, value);
+            break;
+        case H2_HD_USER_AGENT:
+            add_push_header(to_h1, name, nlen, value, vlen);
+            break;
+        case H2_HD_UPGRADE:
+        case H2_HD_CONNECTION:
+        case H2_HD_PROXY_CONNECTION:
+        case H2_HD_KEEP_ALIVE:
+        case H2_HD_HTTP2_SETTINGS:
+            // ignore these.
+            return APR_SUCCESS;
+        default:
+            break;
     }
 
     apr_status_t status = ensure_data(to_h1);
@@ -188,7 +259,7 @@ apr_status_t h2_to_h1_add_header(h2_to_h1 *to_h1,
                 /* if this still does not work, we fail */
             }
         }
-        if (!to_h1->seen_host && H2_HD_MATCH_LIT("host", name, nlen)) {
+        if (hd == H2_HD_HOST) {
             to_h1->seen_host = 1;
         }
     }
@@ -196,6 +267,36 @@ apr_status_t h2_to_h1_add_header(h2_to_h1 *to_h1,
 }
 
 
+apr_off_t h2_to_h1_get_content_length(h2_to_h1 *to_h1)
+{
+    return to_h1->content_length;
+}
+
+int h2_to_h1_expects_continue(h2_to_h1 *to_h1)
+{
+    return to_h1->expect_continue;
+}
+
+int h2_to_h1_get_cache_bypass(h2_to_h1 *to_h1)
+{
+    return to_h1->cache_bypass;
+}
+
+const char *h2_to_h1_get_if_none_match(h2_to_h1 *to_h1)
+{
+    return to_h1->if_none_match;
+}
+
+const char *h2_to_h1_get_variant(h2_to_h1 *to_h1)
+{
+    return to_h1->variant;
+}
+
+apr_table_t *h2_to_h1_get_push_headers(h2_to_h1 *to_h1)
+{
+    return to_h1->push_headers;
+}
+
 apr_status_t h2_to_h1_end_headers(h2_to_h1 *to_h1)
 {
     if (to_h1->eoh) {
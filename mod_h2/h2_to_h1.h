@@ -42,6 +42,36 @@ apr_status_t h2_to_h1_add_header(h2_to_h1 *to_h1,
                                  const char *name, size_t nlen,
                                  const char *value, size_t vlen);
 
+/* Get the value of the content-length header added, -1 if there
+ * was none.
+ */
+apr_off_t h2_to_h1_get_content_length(h2_to_h1 *to_h1);
+
+/* Return != 0 iff the client sent "Expect: 100-continue" and waits
+ * for an interim response before sending the body.
+ */
+int h2_to_h1_expects_continue(h2_to_h1 *to_h1);
+
+/* Return != 0 iff the request headers rule out answering it from
+ * the response cache.
+ */
+int h2_to_h1_get_cache_bypass(h2_to_h1 *to_h1);
+
+/* Get the If-None-Match value of the request, NULL if none was sent.
+ */
+const char *h2_to_h1_get_if_none_match(h2_to_h1 *to_h1);
+
+/* Get the request headers a response commonly varies on (Accept*,
+ * Cookie), as sent in order, NULL if there were none.
+ */
+const char *h2_to_h1_get_variant(h2_to_h1 *to_h1);
+
+/* Get the request headers that requests pushed on its behalf inherit
+ * (Accept-Encoding, Accept-Language, Cookie, User-Agent), NULL if 
+ * there were none.
+ */
+apr_table_t *h2_to_h1_get_push_headers(h2_to_h1 *to_h1);
+
 /* End the request headers.
  */
 apr_status_t h2_to_h1_end_headers(h2_to_h1 *to_h1);
@@ -72,6 +72,105 @@ char *h2_strlwr(char *s)
     return s;
 }
 
+static int in_location(const char *path, const char *location)
+{
+    apr_size_t llen = strlen(location);
+    if (strncmp(path, location, llen)) {
+        return 0;
+    }
+    return (location[llen-1] == '/' || path[llen] == '\0' 
+            || path[llen] == '/' || path[llen] == '?');
+}
+
+int h2_util_in_locations(apr_array_header_t *locations, const char *path)
+{
+    if (locations && path) {
+        for (int i = 0; i < locations->nelts; ++i) {
+            if (in_location(path, APR_ARRAY_IDX(locations, i, const char*))) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Compare name against the lower case literal l of the same length,
+ * ignoring case. The first character has already been checked. */
+static int hd_rest_eq(const char *l, const char *name, size_t nlen)
+{
+    for (size_t i = 1; i < nlen; ++i) {
+        char c = name[i];
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        if (c != l[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+typedef struct {
+    const char *name;
+    size_t len;
+    h2_hd_t hd;
+} hd_entry;
+
+#define HD_DEF(l, hd)   { l, sizeof(l) - 1, hd }
+
+/* Known header names, in lower case. */
+static const hd_entry HD_TABLE[] = {
+    HD_DEF(":authority",        H2_HD_P_AUTHORITY),
+    HD_DEF(":method",           H2_HD_P_METHOD),
+    HD_DEF(":path",             H2_HD_P_PATH),
+    HD_DEF(":scheme",           H2_HD_P_SCHEME),
+    HD_DEF(":status",           H2_HD_P_STATUS),
+    HD_DEF("accept",            H2_HD_ACCEPT),
+    HD_DEF("accept-encoding",   H2_HD_ACCEPT_ENCODING),
+    HD_DEF("accept-language",   H2_HD_ACCEPT_LANGUAGE),
+    HD_DEF("authorization",     H2_HD_AUTHORIZATION),
+    HD_DEF("cache-control",     H2_HD_CACHE_CONTROL),
+    HD_DEF("cache-digest",      H2_HD_CACHE_DIGEST),
+    HD_DEF("connection",        H2_HD_CONNECTION),
+    HD_DEF("content-length",    H2_HD_CONTENT_LENGTH),
+    HD_DEF("cookie",            H2_HD_COOKIE),
+    HD_DEF("expect",            H2_HD_EXPECT),
+    HD_DEF("host",              H2_HD_HOST),
+    HD_DEF("http2-settings",    H2_HD_HTTP2_SETTINGS),
+    HD_DEF("if-none-match",     H2_HD_IF_NONE_MATCH),
+    HD_DEF("keep-alive",        H2_HD_KEEP_ALIVE),
+    HD_DEF("pragma",            H2_HD_PRAGMA),
+    HD_DEF("proxy-connection",  H2_HD_PROXY_CONNECTION),
+    HD_DEF("range",             H2_HD_RANGE),
+    HD_DEF("transfer-encoding", H2_HD_TRANSFER_ENCODING),
+    HD_DEF("upgrade",           H2_HD_UPGRADE),
+    HD_DEF("user-agent",        H2_HD_USER_AGENT),
+};
+static const size_t HD_TABLE_LEN = sizeof(HD_TABLE)/sizeof(HD_TABLE[0]);
+
+h2_hd_t h2_util_hd_classify(const char *name, size_t nlen)
+{
+    char c0;
+    
+    if (nlen == 0) {
+        return H2_HD_UNKNOWN;
+    }
+    c0 = name[0];
+    if (c0 >= 'A' && c0 <= 'Z') {
+        c0 += 'a' - 'A';
+    }
+    /* length and first char rule out nearly all entries without
+     * looking at the name any further */
+    for (size_t i = 0; i < HD_TABLE_LEN; ++i) {
+        const hd_entry *e = &HD_TABLE[i];
+        if (e->len == nlen && e->name[0] == c0 
+            && hd_rest_eq(e->name, name, nlen)) {
+            return e->hd;
+        }
+    }
+    return H2_HD_UNKNOWN;
+}
+
 static const int BASE64URL_TABLE[] = {
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
@@ -180,20 +279,154 @@ const char *h2_util_first_token_match(apr_pool_t *pool, const char *s,
     return NULL;
 }
 
-/* DEEP_COPY==0 crashes under load. I think the setaside is fine, 
- * however buckets moved to another thread will still be
- * free'd against the old bucket_alloc. *And* if the old
- * pool gets destroyed too early, the bucket disappears while
- * still needed.
- */
-static const int DEEP_COPY = 1;
-static const int FILE_MOVE = 0;
+/* A heap bucket whose memory comes from malloc() and that shares it with
+ * no other bucket. Such memory may change threads and bucket_allocs. */
+static int is_movable(apr_bucket *b)
+{
+    if (APR_BUCKET_IS_HEAP(b)) {
+        apr_bucket_heap *h = (apr_bucket_heap *)b->data;
+        return h->free_func == free && h->refcount.refcount == 1;
+    }
+    return 0;
+}
+
+/* A FILE bucket that is the only one reading its apr_bucket_file. The file
+ * may be set aside into another pool and be read from another thread. */
+static int is_movable_file(apr_bucket *b)
+{
+    if (APR_BUCKET_IS_FILE(b)) {
+        apr_bucket_file *f = (apr_bucket_file *)b->data;
+        return f->refcount.refcount == 1;
+    }
+    return 0;
+}
+
+static apr_status_t move_file(apr_bucket_brigade *to, 
+                              apr_bucket_brigade *from, apr_bucket *b, 
+                              apr_pool_t *file_pool)
+{
+    apr_bucket_file *f = (apr_bucket_file *)b->data;
+    apr_file_t *fd = f->fd;
+    
+    if (apr_file_pool_get(fd) != file_pool) {
+        /* The file now lives as long as file_pool, closing it
+         * is no longer the business of the pool that opened it. */
+        apr_status_t status = apr_file_setaside(&fd, f->fd, file_pool);
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        /* The old apr_file_t is dead now. Other buckets on the same 
+         * file, e.g. from a split, read the set aside one and are not 
+         * set aside a second time. */
+        for (apr_bucket *ob = APR_BUCKET_NEXT(b); 
+             ob != APR_BRIGADE_SENTINEL(from); 
+             ob = APR_BUCKET_NEXT(ob)) {
+            if (APR_BUCKET_IS_FILE(ob)) {
+                apr_bucket_file *of = (apr_bucket_file *)ob->data;
+                if (of->fd == f->fd) {
+                    of->fd = fd;
+                }
+            }
+        }
+    }
+    
+    apr_bucket *nb = apr_bucket_file_create(fd, b->start, b->length, 
+                                            to->p, to->bucket_alloc);
+    /* A mmap would be registered in a pool of the reading thread, 
+     * just read it. */
+    apr_bucket_file_enable_mmap(nb, 0);
+    apr_bucket_delete(b);
+    APR_BRIGADE_INSERT_TAIL(to, nb);
+    return APR_SUCCESS;
+}
+
+static int may_make_movable(apr_bucket *b)
+{
+    return !APR_BUCKET_IS_METADATA(b) && !APR_BUCKET_IS_FILE(b) 
+        && !is_movable(b);
+}
+
+apr_status_t h2_util_make_movable(apr_bucket_brigade *to,
+                                 apr_bucket_brigade *from, apr_size_t chunk)
+{
+    apr_status_t status = APR_SUCCESS;
+    int read_unknown = 0;
+    
+    while (!APR_BRIGADE_EMPTY(from) && !read_unknown) {
+        apr_bucket *b = APR_BRIGADE_FIRST(from);
+        if (!may_make_movable(b)) {
+            APR_BUCKET_REMOVE(b);
+            APR_BRIGADE_INSERT_TAIL(to, b);
+            continue;
+        }
+        
+        /* Find the run of buckets that we copy into one chunk. Reading
+         * a bucket of unknown length, e.g. a pipe, adds another such 
+         * bucket after it. We stop after the first one, what the handler
+         * produces has to reach the client before we read more. */
+        apr_bucket *end = b;
+        apr_size_t len = 0;
+        while (end != APR_BRIGADE_SENTINEL(from) && may_make_movable(end)) {
+            if (end->length == (apr_size_t)-1) {
+                const char *ign;
+                apr_size_t ilen;
+                status = apr_bucket_read(end, &ign, &ilen, APR_BLOCK_READ);
+                if (status != APR_SUCCESS) {
+                    return status;
+                }
+                read_unknown = 1;
+            }
+            if (len > 0 && len + end->length > chunk) {
+                break;
+            }
+            len += end->length;
+            end = APR_BUCKET_NEXT(end);
+            if (read_unknown) {
+                break;
+            }
+        }
+        
+        char *buffer = NULL;
+        if (len > 0) {
+            buffer = malloc(len);
+            if (!buffer) {
+                return APR_ENOMEM;
+            }
+        }
+        
+        apr_size_t copied = 0;
+        while (b != end) {
+            const char *data;
+            apr_size_t dlen;
+            status = apr_bucket_read(b, &data, &dlen, APR_BLOCK_READ);
+            if (status != APR_SUCCESS) {
+                free(buffer);
+                return status;
+            }
+            memcpy(buffer + copied, data, dlen);
+            copied += dlen;
+            apr_bucket *next = APR_BUCKET_NEXT(b);
+            apr_bucket_delete(b);
+            b = next;
+        }
+        if (buffer) {
+            APR_BRIGADE_INSERT_TAIL(to, 
+                apr_bucket_heap_create(buffer, len, free, to->bucket_alloc));
+        }
+    }
+    return status;
+}
 
 apr_status_t h2_util_move(apr_bucket_brigade *to, apr_bucket_brigade *from, 
-                          apr_size_t maxlen, const char *msg)
+                          apr_size_t maxlen, apr_pool_t *file_pool,
+                          apr_off_t *pmoved, const char *msg)
 {
     apr_status_t status = APR_SUCCESS;
     
+    if (pmoved) {
+        *pmoved = 0;
+    }
+    
     assert(to);
     assert(from);
     int same_alloc = (to->bucket_alloc == from->bucket_alloc);
@@ -217,7 +450,8 @@ apr_status_t h2_util_move(apr_bucket_brigade *to, apr_bucket_brigade *from,
                     }
                 }
                 
-                if ((same_alloc || FILE_MOVE) && APR_BUCKET_IS_FILE(b)) {
+                if (APR_BUCKET_IS_FILE(b) 
+                    && (same_alloc || (file_pool && is_movable_file(b)))) {
                     /* this has no memory footprint really unless
                      * it is read, disregard it in length count */
                 }
@@ -238,6 +472,16 @@ apr_status_t h2_util_move(apr_bucket_brigade *to, apr_bucket_brigade *from,
                 break;
             }
             
+            if (pmoved && b->length == (apr_size_t)-1) {
+                const char *ign;
+                apr_size_t ilen;
+                status = apr_bucket_read(b, &ign, &ilen, APR_BLOCK_READ);
+                if (status != APR_SUCCESS) {
+                    return status;
+                }
+            }
+            apr_size_t blen = APR_BUCKET_IS_METADATA(b)? 0 : b->length;
+            
             if (same_alloc || (b->list == to->bucket_alloc)) {
                 /* both brigades use the same bucket_alloc and auto-cleanups
                  * have the same life time. It's therefore safe to just move
@@ -245,64 +489,50 @@ apr_status_t h2_util_move(apr_bucket_brigade *to, apr_bucket_brigade *from,
                 APR_BUCKET_REMOVE(b);
                 APR_BRIGADE_INSERT_TAIL(to, b);
             }
-            else if (DEEP_COPY) {
-                /* we have not managed the magic of passing buckets from
-                 * one thread to another. Any attempts result in
-                 * cleanup of pools scrambling memory.
-                 */
-                if (APR_BUCKET_IS_METADATA(b)) {
-                    if (APR_BUCKET_IS_EOS(b)) {
-                        APR_BRIGADE_INSERT_TAIL(to, apr_bucket_eos_create(to->bucket_alloc));
-                    }
-                    else if (APR_BUCKET_IS_FLUSH(b)) {
-                        APR_BRIGADE_INSERT_TAIL(to, apr_bucket_flush_create(to->bucket_alloc));
-                    }
-                    else {
-                        /* ignore */
-                    }
+            else if (is_movable(b)) {
+                /* Hand the memory over to a new bucket of the target,
+                 * the old one frees nothing but itself. */
+                apr_bucket_heap *h = (apr_bucket_heap *)b->data;
+                apr_bucket *nb = apr_bucket_heap_create(h->base, h->alloc_len,
+                                                        free, to->bucket_alloc);
+                nb->start = b->start;
+                nb->length = b->length;
+                h->base = NULL;
+                apr_bucket_delete(b);
+                APR_BRIGADE_INSERT_TAIL(to, nb);
+            }
+            else if (file_pool && is_movable_file(b)) {
+                status = move_file(to, from, b, file_pool);
+            }
+            else if (APR_BUCKET_IS_METADATA(b)) {
+                if (APR_BUCKET_IS_EOS(b)) {
+                    APR_BRIGADE_INSERT_TAIL(to, apr_bucket_eos_create(to->bucket_alloc));
                 }
-                else if (FILE_MOVE && APR_BUCKET_IS_FILE(b)) {
-                    /* We do not want to read files when passing buckets, if
-                     * we can avoid it. However, what we've come up so far
-                     * is not working corrently, resulting either in crashes or
-                     * too many open file descriptors.
-                     */
-                    apr_bucket_file *f = (apr_bucket_file *)b->data;
-                    apr_file_t *fd = f->fd;
-                    int setaside = (f->readpool != to->p);
-                    ap_log_perror(APLOG_MARK, APLOG_NOTICE, 0, to->p,
-                                  "h2_util: %s, moving FILE bucket %ld-%ld "
-                                  "from=%lx(p=%lx) to=%lx(p=%lx), setaside=%d",
-                                  msg, (long)b->start, (long)b->length, 
-                                  (long)from, (long)from->p, 
-                                  (long)to, (long)to->p, setaside);
-                    if (setaside) {
-                        /*status = apr_bucket_setaside(b, to->p);*/
-                        /*status = apr_file_dup(&fd, fd, to->p);*/
-                        status = apr_file_setaside(&fd, fd, to->p);
-                        if (status != APR_SUCCESS) {
-                            ap_log_perror(APLOG_MARK, APLOG_ERR, status, to->p,
-                                          "h2_util: %s, dup on FILE", msg);
-                            return status;
-                        }
-                    }
-                    apr_brigade_insert_file(to, fd, b->start, b->length, 
-                                            to->p);
+                else if (APR_BUCKET_IS_FLUSH(b)) {
+                    APR_BRIGADE_INSERT_TAIL(to, apr_bucket_flush_create(to->bucket_alloc));
                 }
                 else {
-                    const char *data;
-                    apr_size_t len;
-                    status = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
-                    if (status == APR_SUCCESS) {
-                        status = apr_brigade_write(to, NULL, NULL, data, len);
-                    }
+                    /* ignore */
                 }
                 apr_bucket_delete(b);
             }
             else {
-                apr_bucket_setaside(b, to->p);
-                APR_BUCKET_REMOVE(b);
-                APR_BRIGADE_INSERT_TAIL(to, b);
+                /* Anything else may reference memory of the other
+                 * thread's pools or bucket_alloc, or is shared with other
+                 * buckets (mmaps, copies of a FILE): copy the data. A 
+                 * setaside does not do, the bucket would still be freed 
+                 * against the old bucket_alloc. */
+                const char *data;
+                apr_size_t len;
+                status = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
+                if (status == APR_SUCCESS) {
+                    status = apr_brigade_write(to, NULL, NULL, data, len);
+                }
+                apr_bucket_delete(b);
+            }
+            
+            if (pmoved && status == APR_SUCCESS) {
+                *pmoved += blen;
             }
         }
     }
@@ -366,6 +596,61 @@ apr_status_t h2_util_pass(apr_bucket_brigade *to, apr_bucket_brigade *from,
     return status;
 }
 
+apr_status_t h2_util_spool_create(apr_file_t **pspool, 
+                                  apr_file_t **pspool_in, apr_pool_t *pool)
+{
+    const char *tmpdir = NULL;
+    *pspool = *pspool_in = NULL;
+    apr_status_t status = apr_temp_dir_get(&tmpdir, pool);
+    if (status == APR_SUCCESS) {
+        char *tmpl = apr_pstrcat(pool, tmpdir, "/h2_spool_XXXXXX", NULL);
+        status = apr_file_mktemp(pspool, tmpl, 
+                                 (APR_FOPEN_CREATE | APR_FOPEN_WRITE 
+                                  | APR_FOPEN_APPEND | APR_FOPEN_EXCL 
+                                  | APR_FOPEN_DELONCLOSE), 
+                                 pool);
+    }
+    if (status == APR_SUCCESS) {
+        const char *fname;
+        status = apr_file_name_get(&fname, *pspool);
+        if (status == APR_SUCCESS) {
+            status = apr_file_open(pspool_in, fname, 
+                                   APR_FOPEN_READ | APR_FOPEN_BINARY,
+                                   APR_OS_DEFAULT, pool);
+        }
+    }
+    if (status != APR_SUCCESS && *pspool) {
+        apr_file_close(*pspool);
+        *pspool = NULL;
+    }
+    return status;
+}
+
+apr_status_t h2_util_spool_write(apr_file_t *spool, apr_bucket_brigade *bb,
+                                 apr_off_t maxlen, apr_off_t *pwritten)
+{
+    apr_status_t status = APR_SUCCESS;
+    *pwritten = 0;
+    while (!APR_BRIGADE_EMPTY(bb) && (maxlen <= 0 || *pwritten < maxlen)) {
+        apr_bucket *b = APR_BRIGADE_FIRST(bb);
+        if (APR_BUCKET_IS_METADATA(b)) {
+            break;
+        }
+        const char *data;
+        apr_size_t len;
+        status = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
+        if (status == APR_SUCCESS && len > 0) {
+            status = apr_file_write_full(spool, data, len, NULL);
+        }
+        if (status != APR_SUCCESS) {
+            break;
+        }
+        *pwritten += len;
+        apr_bucket_delete(b);
+    }
+    return status;
+}
+
 int h2_util_has_flush_or_eos(apr_bucket_brigade *bb) {
     apr_bucket *b;
     for (b = APR_BRIGADE_FIRST(bb);
@@ -379,3 +664,50 @@ int h2_util_has_flush_or_eos(apr_bucket_brigade *bb) {
     return 0;
 }
 
+
+void h2_pool_cache_init(h2_pool_cache *cache, apr_pool_t *parent, 
+                        int max_spare)
+{
+    cache->parent = parent;
+    cache->max_spare = max_spare;
+    cache->spare = apr_array_make(parent, max_spare, sizeof(apr_pool_t*));
+    cache->created = cache->reused = 0;
+}
+
+apr_status_t h2_pool_cache_get(h2_pool_cache *cache, apr_pool_t **ppool)
+{
+    apr_pool_t **pspare = apr_array_pop(cache->spare);
+    if (pspare) {
+        *ppool = *pspare;
+        ++cache->reused;
+        return APR_SUCCESS;
+    }
+    
+    *ppool = NULL;
+    apr_status_t status = apr_pool_create(ppool, cache->parent);
+    if (status == APR_SUCCESS) {
+        ++cache->created;
+    }
+    return status;
+}
+
+void h2_pool_cache_put(h2_pool_cache *cache, apr_pool_t *pool)
+{
+    if (cache->spare->nelts < cache->max_spare) {
+        /* keeps the first block of memory, returns the rest to
+         * the allocator */
+        apr_pool_clear(pool);
+        APR_ARRAY_PUSH(cache->spare, apr_pool_t*) = pool;
+    }
+    else {
+        apr_pool_destroy(pool);
+    }
+}
+
+void h2_pool_cache_trim(h2_pool_cache *cache, int keep)
+{
+    while (cache->spare->nelts > keep) {
+        apr_pool_t **pspare = apr_array_pop(cache->spare);
+        apr_pool_destroy(*pspare);
+    }
+}
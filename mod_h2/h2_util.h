@@ -36,6 +36,15 @@ int h2_util_contains_token(apr_pool_t *pool, const char *s, const char *token);
 const char *h2_util_first_token_match(apr_pool_t *pool, const char *s, 
                                       const char *tokens[], apr_size_t len);
 
+/**
+ * Return != 0 iff the path is inside one of the locations, using the same
+ * prefix matching as <Location>: /status matches /status, /status/
+ * and /status?x, but not /statusx.
+ * @param locations array of const char* absolute paths, may be NULL
+ * @param path the request path
+ */
+int h2_util_in_locations(apr_array_header_t *locations, const char *path);
+
 /**
  * I always wanted to write my own base64url decoder...not. See 
  * https://tools.ietf.org/html/rfc4648#section-5 for description.
@@ -44,6 +53,60 @@ apr_size_t h2_util_base64url_decode(unsigned char **decoded,
                                     const char *encoded, 
                                     apr_pool_t *pool);
 
+/**
+ * Header names we need to look at when converting between HTTP/2 and
+ * HTTP/1.1. Names are classified once via h2_util_hd_classify() and the
+ * resulting token is used from then on instead of string compares.
+ */
+typedef enum {
+    H2_HD_UNKNOWN,
+    H2_HD_P_AUTHORITY,
+    H2_HD_P_METHOD,
+    H2_HD_P_PATH,
+    H2_HD_P_SCHEME,
+    H2_HD_P_STATUS,
+    H2_HD_ACCEPT,
+    H2_HD_ACCEPT_ENCODING,
+    H2_HD_ACCEPT_LANGUAGE,
+    H2_HD_AUTHORIZATION,
+    H2_HD_CACHE_CONTROL,
+    H2_HD_CACHE_DIGEST,
+    H2_HD_CONNECTION,
+    H2_HD_CONTENT_LENGTH,
+    H2_HD_COOKIE,
+    H2_HD_EXPECT,
+    H2_HD_HOST,
+    H2_HD_HTTP2_SETTINGS,
+    H2_HD_IF_NONE_MATCH,
+    H2_HD_KEEP_ALIVE,
+    H2_HD_PRAGMA,
+    H2_HD_PROXY_CONNECTION,
+    H2_HD_RANGE,
+    H2_HD_TRANSFER_ENCODING,
+    H2_HD_UPGRADE,
+    H2_HD_USER_AGENT,
+} h2_hd_t;
+
+/**
+ * Classify a header name, case-insensitive, by looking at its length
+ * and first character only before doing a single compare.
+ * @param name the header name, need not be 0-terminated
+ * @param nlen the length of the name
+ * @return the header token or H2_HD_UNKNOWN
+ */
+h2_hd_t h2_util_hd_classify(const char *name, size_t nlen);
+
+/**
+ * Return != 0 iff the header with the given token must not be forwarded
+ * on a HTTP/2 connection, see ch. 8.1.2.2.
+ */
+#define H2_HD_IS_CONN_SPECIFIC(hd)       \
+    ((hd) == H2_HD_CONNECTION            \
+     || (hd) == H2_HD_PROXY_CONNECTION   \
+     || (hd) == H2_HD_KEEP_ALIVE         \
+     || (hd) == H2_HD_TRANSFER_ENCODING  \
+     || (hd) == H2_HD_UPGRADE)
+
 #define H2_HD_MATCH_LIT(l, name, nlen)  \
     ((nlen == sizeof(l) - 1) && !apr_strnatcasecmp(l, name))
 
@@ -69,16 +132,61 @@ apr_size_t h2_util_base64url_decode(unsigned char **decoded,
  * Moves data from one brigade into another. If maxlen > 0, it only
  * moves up to maxlen bytes into the target brigade, making bucket splits
  * if needed.
+ * Between brigades of different bucket_allocs, malloc'ed heap buckets 
+ * change owner and, if file_pool is given, so do FILE buckets not shared
+ * with other buckets. Their file is set aside into file_pool and is not 
+ * counted against maxlen. All other data is copied.
  * @param to the brigade to move the data to
  * @param from the brigade to get the data from
  * @param maxlen of bytes to move, 0 for all
+ * @param file_pool the pool files are handed to, NULL to copy file data
+ * @param pmoved on return, the number of data bytes moved, may be NULL
  */
 apr_status_t h2_util_move(apr_bucket_brigade *to, apr_bucket_brigade *from, 
-                          apr_size_t maxlen, const char *msg);
+                          apr_size_t maxlen, apr_pool_t *file_pool,
+                          apr_off_t *pmoved, const char *msg);
 
 apr_status_t h2_util_pass(apr_bucket_brigade *to, apr_bucket_brigade *from, 
                           apr_size_t maxlen);
 
+/**
+ * Move buckets from one brigade to the other, copying their data into
+ * malloc'ed heap buckets of up to chunk bytes, unless a single bucket is
+ * larger. h2_util_move() hands such buckets to a brigade of another 
+ * bucket_alloc without copying, which allows the copy to be made before
+ * a lock is taken. Metadata and FILE buckets are moved as they are.
+ * Once a bucket of unknown length has been read, the rest is left in
+ * from, so output of a pipe or socket is passed on a chunk at a time.
+ * @param to the brigade to append the movable buckets to
+ * @param from the brigade to take the buckets from
+ * @param chunk the number of bytes to collect in one bucket
+ */
+apr_status_t h2_util_make_movable(apr_bucket_brigade *to,
+                                 apr_bucket_brigade *from, apr_size_t chunk);
+
+/**
+ * Create a temporary file to spool output to, removed once closed, and
+ * a second handle to read it through, so the reader's seeks do not get
+ * in the way of the writer's appends.
+ * @param pspool on return, the handle to append to
+ * @param pspool_in on return, the handle to read through
+ * @param pool the pool both handles are allocated from
+ */
+apr_status_t h2_util_spool_create(apr_file_t **pspool, 
+                                  apr_file_t **pspool_in, apr_pool_t *pool);
+
+/**
+ * Write the data at the head of the brigade to the spool, up to the
+ * first metadata bucket or until maxlen bytes have been written. The
+ * buckets written are deleted.
+ * @param spool the spool to append to
+ * @param bb the brigade to take the data from
+ * @param maxlen the number of bytes to write at most, 0 for no limit
+ * @param pwritten on return, the number of bytes written
+ */
+apr_status_t h2_util_spool_write(apr_file_t *spool, apr_bucket_brigade *bb,
+                                 apr_off_t maxlen, apr_off_t *pwritten);
+
 /**
  * Return != 0 iff there is a FLUSH or EOS bucket in the brigade.
  * @param bb the brigade to check on
@@ -86,4 +194,42 @@ apr_status_t h2_util_pass(apr_bucket_brigade *to, apr_bucket_brigade *from,
  */
 int h2_util_has_flush_or_eos(apr_bucket_brigade *bb);
 
+/**
+ * Keeps cleared sub pools of a parent around for reuse, so that objects 
+ * living in a pool of their own do not cost a pool creation and 
+ * destruction each time. Not thread safe, the owner serializes access.
+ */
+typedef struct h2_pool_cache {
+    apr_pool_t *parent;
+    apr_array_header_t *spare;
+    int max_spare;
+    long created;               /* pools created for lack of a spare one */
+    long reused;                /* pools handed out again after clearing */
+} h2_pool_cache;
+
+/**
+ * Set up the cache, spare pools are kept in and go away with the parent.
+ * @param cache the cache to initialize
+ * @param parent the pool new pools are created in
+ * @param max_spare the max number of cleared pools to keep
+ */
+void h2_pool_cache_init(h2_pool_cache *cache, apr_pool_t *parent, 
+                        int max_spare);
+
+/**
+ * Get a spare pool or, if there is none, create a new one.
+ */
+apr_status_t h2_pool_cache_get(h2_pool_cache *cache, apr_pool_t **ppool);
+
+/**
+ * Give back a pool obtained from the cache. It is cleared and kept for
+ * reuse or destroyed if there are enough spare pools already.
+ */
+void h2_pool_cache_put(h2_pool_cache *cache, apr_pool_t *pool);
+
+/**
+ * Destroy spare pools until at most keep of them are left.
+ */
+void h2_pool_cache_trim(h2_pool_cache *cache, int keep);
+
 #endif /* defined(__mod_h2__h2_util__) */
@@ -23,6 +23,7 @@
 
 #include "h2_private.h"
 #include "h2_task.h"
+#include "h2_util.h"
 #include "h2_worker.h"
 
 struct h2_worker {
@@ -32,6 +33,7 @@ struct h2_worker {
     apr_bucket_alloc_t *bucket_alloc;
     apr_thread_cond_t *io;
     apr_socket_t *socket;
+    h2_pool_cache conn_pools;   /* the cleared pool of the last task */
     
     h2_worker_task_next_fn *get_next;
     h2_worker_task_done_fn *task_done;
@@ -81,23 +83,41 @@ static void *execute(apr_thread_t *thread, void *wctx)
     return NULL;
 }
 
+/* The worker's pool gets an allocator of its own, which is destroyed
+ * with the worker. Memory beyond max_mem_free that the allocator has
+ * free is given back, so that the peak of one large request is not 
+ * kept around forever. */
+static apr_status_t worker_pool_create(apr_pool_t **ppool, 
+                                       apr_pool_t *parent_pool,
+                                       apr_size_t max_mem_free)
+{
+    apr_allocator_t *allocator = NULL;
+    apr_status_t status = apr_allocator_create(&allocator);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    if (max_mem_free) {
+        apr_allocator_max_free_set(allocator, max_mem_free);
+    }
+    
+    status = apr_pool_create_ex(ppool, parent_pool, NULL, allocator);
+    if (status != APR_SUCCESS) {
+        apr_allocator_destroy(allocator);
+    }
+    return status;
+}
+
 h2_worker *h2_worker_create(int id,
                             apr_pool_t *parent_pool,
                             apr_threadattr_t *attr,
+                            apr_size_t max_mem_free,
                             h2_worker_task_next_fn *get_next,
                             h2_worker_task_done_fn *task_done,
                             h2_worker_done_fn *worker_done,
                             void *ctx)
 {
-    apr_allocator_t *allocator = NULL;
     apr_pool_t *pool = NULL;
-    
-    apr_status_t status = apr_allocator_create(&allocator);
-    if (status != APR_SUCCESS) {
-        return NULL;
-    }
-    
-    status = apr_pool_create_ex(&pool, parent_pool, NULL, allocator);
+    apr_status_t status = worker_pool_create(&pool, parent_pool, max_mem_free);
     if (status != APR_SUCCESS) {
         return NULL;
     }
@@ -107,6 +127,7 @@ h2_worker *h2_worker_create(int id,
         w->id = id;
         w->pool = pool;
         w->bucket_alloc = apr_bucket_alloc_create(pool);
+        h2_pool_cache_init(&w->conn_pools, pool, 1);
 
         w->get_next = get_next;
         w->task_done = task_done;
@@ -123,6 +144,35 @@ h2_worker *h2_worker_create(int id,
     return w;
 }
 
+h2_worker *h2_worker_create_inline(int id, apr_pool_t *parent_pool,
+                                   apr_thread_t *thread, 
+                                   apr_size_t max_mem_free)
+{
+    apr_pool_t *pool = NULL;
+    apr_status_t status = worker_pool_create(&pool, parent_pool, max_mem_free);
+    if (status != APR_SUCCESS) {
+        return NULL;
+    }
+    
+    h2_worker *w = apr_pcalloc(pool, sizeof(h2_worker));
+    w->id = id;
+    w->pool = pool;
+    w->thread = thread;
+    w->bucket_alloc = apr_bucket_alloc_create(pool);
+    h2_pool_cache_init(&w->conn_pools, pool, 1);
+    
+    /* same as our threaded workers, give the connection a socket */
+    status = apr_socket_create(&w->socket, APR_INET, SOCK_STREAM,
+                               APR_PROTO_TCP, w->pool);
+    if (status != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_ERR, status, w->pool,
+                      "h2_worker(%d): alloc socket", w->id);
+        h2_worker_destroy(w);
+        return NULL;
+    }
+    return w;
+}
+
 apr_status_t h2_worker_destroy(h2_worker *worker)
 {
     if (worker->io) {
@@ -130,6 +180,10 @@ apr_status_t h2_worker_destroy(h2_worker *worker)
         worker->io = NULL;
     }
     if (worker->pool) {
+        ap_log_perror(APLOG_MARK, APLOG_DEBUG, 0, worker->pool,
+                      "h2_worker(%d): conn pools created/reused: %ld/%ld",
+                      worker->id, worker->conn_pools.created, 
+                      worker->conn_pools.reused);
         apr_allocator_t *allocator = apr_pool_allocator_get(worker->pool);
         apr_pool_destroy(worker->pool);
         /* worker is gone */
@@ -180,6 +234,16 @@ apr_pool_t *h2_worker_get_pool(h2_worker *worker)
     return worker->pool;
 }
 
+apr_status_t h2_worker_get_conn_pool(h2_worker *worker, apr_pool_t **ppool)
+{
+    return h2_pool_cache_get(&worker->conn_pools, ppool);
+}
+
+void h2_worker_put_conn_pool(h2_worker *worker, apr_pool_t *pool)
+{
+    h2_pool_cache_put(&worker->conn_pools, pool);
+}
+
 apr_bucket_alloc_t *h2_worker_get_bucket_alloc(h2_worker *worker)
 {
     return worker->bucket_alloc;
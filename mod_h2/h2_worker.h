@@ -42,16 +42,26 @@ typedef h2_task *h2_worker_task_done_fn(h2_worker *worker,
 typedef void h2_worker_done_fn(h2_worker *worker, void *ctx);
 
 /* Create a new worker with given id, pool and attributes, callbacks
- * callback parameter.
+ * callback parameter. The worker's allocator keeps at most max_mem_free
+ * bytes of freed memory, 0 for no limit.
  */
 h2_worker *h2_worker_create(int id,
                             apr_pool_t *pool,
                             apr_threadattr_t *attr,
+                            apr_size_t max_mem_free,
                             h2_worker_task_next_fn *get_next,
                             h2_worker_task_done_fn *task_done,
                             h2_worker_done_fn *worker_done,
                             void *ctx);
 
+/* Create a worker that has no thread of its own. Tasks are run on it
+ * by calling h2_task_do() from the given thread, which must not block
+ * on task io. There is no condition for io waits on such a worker.
+ */
+h2_worker *h2_worker_create_inline(int id, apr_pool_t *pool,
+                                   apr_thread_t *thread, 
+                                   apr_size_t max_mem_free);
+
 apr_status_t h2_worker_destroy(h2_worker *worker);
 
 void h2_worker_abort(h2_worker *worker);
@@ -62,6 +72,13 @@ int h2_worker_is_aborted(h2_worker *worker);
 
 apr_pool_t *h2_worker_get_pool(h2_worker *worker);
 
+/* Get a pool for the connection of a task. The worker keeps the pool
+ * of its last task around, so one task after the other reuses it. */
+apr_status_t h2_worker_get_conn_pool(h2_worker *worker, apr_pool_t **ppool);
+
+/* Give back the pool of a task's connection, once the task is done. */
+void h2_worker_put_conn_pool(h2_worker *worker, apr_pool_t *pool);
+
 apr_bucket_alloc_t *h2_worker_get_bucket_alloc(h2_worker *worker);
 
 apr_socket_t *h2_worker_get_socket(h2_worker *worker);
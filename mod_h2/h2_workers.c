@@ -23,6 +23,7 @@
 #include <http_log.h>
 
 #include "h2_private.h"
+#include "h2_mplx.h"
 #include "h2_queue.h"
 #include "h2_task.h"
 #include "h2_worker.h"
@@ -38,6 +39,7 @@ struct h2_workers {
     int max_size;
     
     apr_threadattr_t *thread_attr;
+    apr_size_t max_mem_free;        /* per worker allocator, 0 unlimited */
     
     int worker_count;
     struct h2_queue *workers;
@@ -127,6 +129,11 @@ static h2_task *task_done(h2_worker *worker, h2_task *task,
                      h2_worker_get_id(worker), h2_task_get_id(task));
         
         h2_task_set_finished(task, 1);
+        if (task->mplx) {
+            /* still under our lock, so a join cannot see the task 
+             * finished and have the mplx destroyed before this */
+            h2_mplx_task_done(task->mplx, task->stream_id);
+        }
         next_task = pop_next_task(workers);
         
         apr_thread_cond_signal(h2_worker_get_cond(worker));
@@ -155,6 +162,7 @@ static apr_status_t add_worker(h2_workers *workers)
 {
     h2_worker *w = h2_worker_create(workers->next_worker_id++,
                                     workers->pool, workers->thread_attr,
+                                    workers->max_mem_free,
                                     get_task_next, task_done, worker_done,
                                     workers);
     if (!w) {
@@ -182,7 +190,9 @@ static apr_status_t h2_workers_start(h2_workers *workers) {
 }
 
 h2_workers *h2_workers_create(server_rec *s, apr_pool_t *pool,
-                              int min_size, int max_size)
+                              int min_size, int max_size,
+                              apr_size_t stack_size, 
+                              apr_size_t max_mem_free)
 {
     assert(s);
     assert(pool);
@@ -194,9 +204,13 @@ h2_workers *h2_workers_create(server_rec *s, apr_pool_t *pool,
         workers->pool = pool;
         workers->min_size = min_size;
         workers->max_size = max_size;
+        workers->max_mem_free = max_mem_free;
         apr_atomic_set32(&workers->max_idle_secs, 10);
         
         apr_threadattr_create(&workers->thread_attr, workers->pool);
+        if (stack_size > 0) {
+            apr_threadattr_stacksize_set(workers->thread_attr, stack_size);
+        }
         
         workers->workers = h2_queue_create(workers->pool, NULL);
         workers->tasks_scheduled = h2_queue_create(workers->pool, NULL);
@@ -327,6 +341,17 @@ apr_status_t h2_workers_join(h2_workers *workers, h2_task *task, int wait)
     return status;
 }
 
+int h2_workers_has_backlog(h2_workers *workers)
+{
+    int backlog = 0;
+    apr_status_t status = apr_thread_mutex_lock(workers->lock);
+    if (status == APR_SUCCESS) {
+        backlog = !h2_queue_is_empty(workers->tasks_scheduled);
+        apr_thread_mutex_unlock(workers->lock);
+    }
+    return backlog;
+}
+
 void h2_workers_set_max_idle_secs(h2_workers *workers, int idle_secs)
 {
     if (idle_secs <= 0) {
@@ -346,6 +371,15 @@ void h2_workers_log_stats(h2_workers *workers)
                      "h2_workers: %ld threads, %ld tasks todo",
                      h2_queue_size(workers->workers),
                      h2_queue_size(workers->tasks_scheduled));
+        if (workers->max_mem_free) {
+            /* what the threads may hold on to without using it */
+            ap_log_error(APLOG_MARK, APLOG_INFO, 0, workers->s,
+                         "h2_workers: at most %ld bytes kept free, "
+                         "%ld per thread",
+                         (long)(workers->max_mem_free 
+                                * h2_queue_size(workers->workers)),
+                         (long)workers->max_mem_free);
+        }
         apr_thread_mutex_unlock(workers->lock);
     }
 }
@@ -28,10 +28,14 @@ struct h2_task;
 typedef struct h2_workers h2_workers;
 
 /* Create a worker pool with the given minimum and maximum number of
- * threads.
+ * threads. Threads get stack_size bytes of stack, 0 for the system
+ * default, and keep at most max_mem_free bytes of freed memory, 0 for
+ * no limit.
  */
 h2_workers *h2_workers_create(server_rec *s, apr_pool_t *pool,
-                              int min_size, int max_size);
+                              int min_size, int max_size,
+                              apr_size_t stack_size, 
+                              apr_size_t max_mem_free);
 
 /* Destroy the worker pool and all its threads. 
  */
@@ -50,6 +54,11 @@ apr_status_t h2_workers_schedule(h2_workers *workers, h2_task *task);
  */
 apr_status_t h2_workers_join(h2_workers *workers, h2_task *task, int wait);
 
+/* Return != 0 iff there are tasks scheduled that no worker has
+ * started yet.
+ */
+int h2_workers_has_backlog(h2_workers *workers);
+
 /* Log some statistics about budy/idle workers etc. 
  */
 void h2_workers_log_stats(h2_workers *workers);
@@ -27,6 +27,8 @@
 #include "h2_conn.h"
 #include "h2_task.h"
 #include "h2_session.h"
+#include "h2_cache.h"
+#include "h2_flight.h"
 #include "h2_config.h"
 #include "h2_ctx.h"
 #include "h2_h2.h"
@@ -91,6 +93,16 @@ static void h2_child_init(apr_pool_t *pool, server_rec *s)
         ap_log_error(APLOG_MARK, APLOG_ERR, status, s,
                       "initializing connection handling");
     }
+    status = h2_cache_child_init(pool, s);
+    if (status != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, status, s,
+                      "initializing response cache");
+    }
+    status = h2_flight_child_init(pool, s);
+    if (status != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, status, s,
+                      "initializing request collapsing");
+    }
 }
 
 const char *h2_get_protocol(conn_rec *c)
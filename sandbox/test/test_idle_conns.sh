@@ -0,0 +1,103 @@
+#!/bin/bash
+# Copyright 2015 greenbytes GmbH (https://www.greenbytes.de)
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+#
+# Opens a number of h2c connections, each doing one request, and keeps
+# them open without further requests. Reports by how much the resident
+# memory of the httpd children grew per idle connection, right after
+# the requests and after the connections shed their stream state. Fails
+# if a connection did not shed its HPACK table or the memory is above
+# the given bound. The idle connections are held by the shell, since h2
+# clients close theirs when done. They acknowledge the SETTINGS the 
+# server sends, on connect and when it sheds its HPACK table. 
+# Afterwards, nghttp checks that the server still answers.
+#
+
+source test_common.sh
+
+COUNT="${2:-200}"
+SHED_SECS="${3:-5}"
+MAX_IDLE_BYTES="${4:-65536}"
+PORT="${AUTH##*:}"
+PID_FILE="${INSTALL_DIR}/logs/httpd.pid"
+
+# SETTINGS ACK and, as hex, the SETTINGS_HEADER_TABLE_SIZE=0 of shedding
+SETTINGS_ACK="\x00\x00\x00\x04\x01\x00\x00\x00\x00"
+SHED_SETTINGS=" 00 00 06 04 00 00 00 00 00 00 01 00 00 00 00"
+HTTP_101=" 48 54 54 50 2f 31 2e 31 20 31 30 31"
+
+children_rss() {
+    local sum=0
+    for pid in $(pgrep -P $(cat $PID_FILE)); do
+        sum=$(( sum + $(ps -o rss= -p $pid) ))
+    done
+    echo $sum
+}
+
+per_conn() {
+    echo $(( ($(children_rss) - RSS_START) * 1024 / COUNT ))
+}
+
+# What the server sent on the connection so far, as hex bytes
+received() {
+    timeout 0.1 cat <&$1 | od -An -v -tx1 | tr -d '\n'
+}
+
+echo "-- idle connections: $COUNT on $URL_PREFIX --"
+sleep 1
+RSS_START=$(children_rss)
+
+FDS=""
+for (( i = 0; i < $COUNT; ++i )); do
+    exec {fd}<>/dev/tcp/127.0.0.1/$PORT || fail "connect failed"
+    FDS="$FDS $fd"
+    printf "GET /index.html HTTP/1.1\r\nHost: $AUTH\r\n" >&$fd
+    printf "Connection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\n" >&$fd
+    printf "HTTP2-Settings: AAMAAABkAAQAAP__\r\n\r\n" >&$fd
+    # connection preface and an empty SETTINGS frame
+    printf "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" >&$fd
+    printf "\x00\x00\x00\x04\x00\x00\x00\x00\x00" >&$fd
+done
+
+sleep 1
+for fd in $FDS; do
+    case "$(received $fd)" in
+        "$HTTP_101"*) printf "$SETTINGS_ACK" >&$fd ;;
+        *) fail "connection $fd: no upgrade to h2c" ;;
+    esac
+done
+echo "after request: $(per_conn) bytes per connection"
+
+sleep $(( SHED_SECS + 1 ))
+SHED=0
+for fd in $FDS; do
+    case "$(received $fd)" in
+        *"$SHED_SETTINGS"*) 
+            printf "$SETTINGS_ACK" >&$fd
+            SHED=$(( SHED + 1 ))
+            ;;
+    esac
+done
+sleep 1
+IDLE=$(per_conn)
+echo "idle: $IDLE bytes per connection, $SHED connections shed their table"
+(( SHED == COUNT )) || fail "only $SHED of $COUNT connections shed their table"
+(( IDLE <= MAX_IDLE_BYTES )) || fail "idle connections use more than $MAX_IDLE_BYTES bytes"
+
+nghttp_check_doc index.html "while connections idle"
+
+for fd in $FDS; do
+    exec {fd}>&-
+done